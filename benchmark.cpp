@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <algorithm>
 #include <string>
 #include <iostream>
@@ -6,8 +8,24 @@
 #include <random>
 #include <vector>
 #include <chrono>
+#include <map>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
+#include "node_pool.h"
 #include "trees.h"
+#include "trees.hpp"
+#include "tree_par.h"
+#include "tree_rw.h"
+#include "skiplist.h"
+#include "ptree.h"
+#include "tree_file.h"
+#include "tree_dump.h"
+#include "seq_treap.h"
+#include "interval_tree.h"
+#include "ctree.h"
 
 using std::string;
 using std::cout;
@@ -46,8 +64,10 @@ auto random_keys(size_t length) -> vector<string> {
     return v;
 }
 
-struct tree_node* new_node(string key) {
-    struct tree_node* n = (struct tree_node*)malloc(sizeof(struct tree_node));
+// aug: a struct tree_node_aug, for trees with order_stat or agg_combine set
+struct tree_node* new_node(string key, bool aug = false) {
+    struct tree_node* n = (struct tree_node*)malloc(aug ? sizeof(struct tree_node_aug)
+                                                        : sizeof(struct tree_node));
     assert(n);
     n->p = n->left = n->right = t_nil;
     n->key = static_cast<void*>(new string(key));
@@ -72,6 +92,9 @@ void free_treap_node(struct tree_node* n) {
 int less(void* a, void* b) { 
     return *static_cast<string*>(a) < *static_cast<string*>(b);
 }
+int cmp(void* a, void* b) {
+    return static_cast<string*>(a)->compare(*static_cast<string*>(b));
+}
 int pri_less(void *a, void *b) {
     return reinterpret_cast<long>(a) < reinterpret_cast<long>(b);
 }
@@ -214,14 +237,1618 @@ void bench_treap(const vector<string> &keys) {
     cout << "treap\t" << height << "," << insert_time << "," << search_time << "," << delete_time << endl;
 }
 
+unsigned long cmp_calls = 0;
+int counted_less(void* a, void* b) {
+    cmp_calls++;
+    return less(a, b);
+}
+int counted_cmp(void* a, void* b) {
+    cmp_calls++;
+    return cmp(a, b);
+}
+
+// rb tree insert+search, once counting comparator calls and once timed
+void bench_cmp_one(const char *name, const vector<string> &keys,
+                   int (*key_less)(void*, void*), int (*key_cmp)(void*, void*),
+                   int (*counted)(void*, void*)) {
+    unsigned long insert_calls = 0, search_calls = 0;
+    long insert_time = 0, search_time = 0;
+    for (int counting = 1; counting >= 0; counting--) {
+        struct tree t = T_INITIAL;
+        t.type = T_RB;
+        t.key_less = key_less;
+        t.key_cmp = key_cmp;
+        if (counting && key_cmp)
+            t.key_cmp = counted;
+        else if (counting)
+            t.key_less = counted;
+        vector<struct tree_node*> nodes;
+        for (auto key: keys) {
+            nodes.push_back(new_node(key));
+        }
+
+        cmp_calls = 0;
+        auto start = high_resolution_clock::now();
+        for (auto n: nodes) {
+            rb_tree_insert(&t, n);
+        }
+        auto end = high_resolution_clock::now();
+        if (counting)
+            insert_calls = cmp_calls;
+        else
+            insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+        cmp_calls = 0;
+        start = high_resolution_clock::now();
+        for (auto key: keys) {
+            tree_search(&t, static_cast<void*>(&key));
+        }
+        end = high_resolution_clock::now();
+        if (counting)
+            search_calls = cmp_calls;
+        else
+            search_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+        for (auto n: nodes) {
+            free_node(n);
+        }
+    }
+    cout << name << "\t" << insert_calls << "," << search_calls << ","
+         << insert_time << "," << search_time << endl;
+}
+
+void bench_cmp(const vector<string> &keys) {
+    cout << "type\tinsert_calls,search_calls,insert_time,search_time" << endl;
+    bench_cmp_one("rb-less", keys, less, NULL, counted_less);
+    bench_cmp_one("rb-cmp", keys, less, cmp, counted_cmp);
+}
+
+// insert/search/erase through a std::map-like interface
+template <class Map>
+void bench_map(const char *name, const vector<string> &keys) {
+    Map m;
+
+    auto start = high_resolution_clock::now();
+    for (auto &key: keys) {
+        m.insert(std::make_pair(key, 0));
+    }
+    auto end = high_resolution_clock::now();
+    auto insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    size_t found = 0;
+    start = high_resolution_clock::now();
+    for (auto &key: keys) {
+        found += m.find(key) != m.end();
+    }
+    end = high_resolution_clock::now();
+    auto search_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(found == keys.size());
+
+    start = high_resolution_clock::now();
+    for (auto &key: keys) {
+        m.erase(key);
+    }
+    end = high_resolution_clock::now();
+    auto delete_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    cout << name << "\t" << insert_time << "," << search_time << "," << delete_time << endl;
+}
+
+void bench_cpp(const vector<string> &keys) {
+    cout << "type\theight,insert_time,search_time,delete_time" << endl;
+    bench_rb(keys);
+    cout << "type\tinsert_time,search_time,delete_time" << endl;
+    bench_map<trees::tree_map<string, int>>("tpl-rb", keys);
+    bench_map<trees::tree_map<string, int, std::less<string>, trees::avl_balance>>("tpl-avl", keys);
+    bench_map<trees::tree_map<string, int, std::less<string>, trees::treap_balance>>("tpl-treap", keys);
+    bench_map<std::map<string, int>>("std::map", keys);
+}
+
+typedef struct tree_node *(*insert_fn)(struct tree *t, struct tree_node *z);
+
+void free_plain_node(struct tree_node *n) {
+    free(n);
+}
+
+// free every node of t bottom-up, one free per node
+void free_tree(struct tree *t, void (*free_fn)(struct tree_node *n) = free_node) {
+    struct tree_node *x = t->root;
+    while (x != t_nil) {
+        if (x->left != t_nil) {
+            x = x->left;
+        } else if (x->right != t_nil) {
+            x = x->right;
+        } else {
+            struct tree_node *p = x->p;
+            if (p != t_nil) {
+                if (p->left == x)
+                    p->left = t_nil;
+                else
+                    p->right = t_nil;
+            }
+            free_fn(x);
+            x = p;
+        }
+    }
+    t->root = t_nil;
+}
+
+// malloc'd nodes vs. pooled nodes; both point at the key set, so only the
+// allocator differs
+void bench_pool_one(const char *name, enum rb_tree_type type, insert_fn insert,
+                    const vector<string> &keys, bool pooled) {
+    struct tree t = T_INITIAL;
+    t.type = type;
+    t.key_less = less;
+    t.priority_less = pri_less;
+    struct node_pool pool;
+    node_pool_init(&pool, sizeof(struct tree_node), 4096);
+    std::uniform_int_distribution<int> uni2(0, 100000007);
+
+    auto start = high_resolution_clock::now();
+    for (auto &key: keys) {
+        struct tree_node *n;
+        if (pooled) {
+            n = static_cast<struct tree_node*>(node_pool_alloc(&pool));
+        } else {
+            n = static_cast<struct tree_node*>(malloc(sizeof(struct tree_node)));
+        }
+        assert(n);
+        n->key = const_cast<string*>(&key);
+        n->fea.priority = reinterpret_cast<void*>(static_cast<long>(uni2(rng)));
+        insert(&t, n);
+    }
+    auto end = high_resolution_clock::now();
+    auto insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    start = high_resolution_clock::now();
+    for (auto &key: keys) {
+        tree_search(&t, const_cast<string*>(&key));
+    }
+    end = high_resolution_clock::now();
+    auto search_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    start = high_resolution_clock::now();
+    if (pooled)
+        node_pool_destroy_tree(&pool, &t);
+    else
+        free_tree(&t, free_plain_node);
+    end = high_resolution_clock::now();
+    auto teardown_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    cout << name << (pooled ? "-pool" : "-malloc") << "\t" << insert_time << ","
+         << search_time << "," << teardown_time << endl;
+}
+
+void bench_pool(const vector<string> &keys) {
+    cout << "type\tinsert_time,search_time,teardown_time" << endl;
+    for (int pooled = 0; pooled < 2; pooled++) {
+        bench_pool_one("bst", T_BST, bst_insert, keys, pooled);
+        bench_pool_one("rb", T_RB, rb_tree_insert, keys, pooled);
+        bench_pool_one("avl", T_AVL, avl_insert, keys, pooled);
+        bench_pool_one("treap", T_TREAP, treap_insert, keys, pooled);
+    }
+}
+
+long build_tree(struct tree *t, insert_fn insert, const vector<string> &keys,
+                vector<struct tree_node*> &nodes, bool aug = false) {
+    nodes.clear();
+    for (auto &key: keys) {
+        nodes.push_back(new_node(key, aug));
+    }
+    auto start = high_resolution_clock::now();
+    for (auto n: nodes) {
+        insert(t, n);
+    }
+    auto end = high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+// tree_select/tree_rank against walking tree_successor from the minimum
+void bench_rank_one(const char *name, enum rb_tree_type type, insert_fn insert,
+                    const vector<string> &keys) {
+    vector<struct tree_node*> nodes;
+    struct tree plain = T_INITIAL;
+    plain.type = type;
+    plain.key_less = less;
+    auto insert_plain = build_tree(&plain, insert, keys, nodes);
+    free_tree(&plain);
+
+    struct tree t = T_INITIAL;
+    t.type = type;
+    t.key_less = less;
+    t.order_stat = 1;
+    auto insert_os = build_tree(&t, insert, keys, nodes, true);
+
+    size_t queries = std::min<size_t>(keys.size(), 1000);
+    std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+    vector<size_t> ks;
+    for (size_t i = 0; i < queries; i++) {
+        ks.push_back(pick(rng));
+    }
+
+    size_t sum = 0;
+    auto start = high_resolution_clock::now();
+    for (auto k: ks) {
+        sum += reinterpret_cast<size_t>(tree_select(&t, k));
+    }
+    auto end = high_resolution_clock::now();
+    auto select_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    start = high_resolution_clock::now();
+    for (auto k: ks) {
+        struct tree_node *x = tree_min(&t, t.root);
+        for (size_t i = 0; i < k; i++) {
+            x = tree_successor(&t, x);
+        }
+        sum -= reinterpret_cast<size_t>(x);
+    }
+    end = high_resolution_clock::now();
+    auto walk_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(sum == 0);
+
+    start = high_resolution_clock::now();
+    for (auto k: ks) {
+        sum += tree_rank(&t, const_cast<string*>(&keys[k]));
+    }
+    end = high_resolution_clock::now();
+    auto rank_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    free_tree(&t);
+    cout << name << "\t" << insert_plain << "," << insert_os << "," << select_time
+         << "," << walk_time << "," << rank_time << endl;
+}
+
+void bench_rank(const vector<string> &keys) {
+    cout << "type\tinsert_time,insert_time_os,select_time,walk_time,rank_time" << endl;
+    bench_rank_one("rb", T_RB, rb_tree_insert, keys);
+    bench_rank_one("avl", T_AVL, avl_insert, keys);
+}
+
+// cold start from a sorted snapshot: tree_build_sorted vs one insert per key
+void bench_build_one(const char *name, enum rb_tree_type type, insert_fn insert,
+                     const vector<string> &sorted) {
+    std::uniform_int_distribution<int> uni2(0, 100000007);
+    long times[2];
+    int heights[2];
+    for (int bulk = 0; bulk < 2; bulk++) {
+        struct tree t = T_INITIAL;
+        t.type = type;
+        t.key_less = less;
+        t.priority_less = pri_less;
+        vector<struct tree_node*> nodes;
+        for (auto &key: sorted) {
+            nodes.push_back(new_treap_node(key, uni2(rng)));
+        }
+        auto start = high_resolution_clock::now();
+        if (bulk) {
+            tree_build_sorted(&t, nodes.data(), nodes.size());
+        } else {
+            for (auto n: nodes) {
+                insert(&t, n);
+            }
+        }
+        auto end = high_resolution_clock::now();
+        times[bulk] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        heights[bulk] = tree_height(&t, t.root);
+        free_tree(&t);
+    }
+    cout << name << "\t" << heights[0] << "," << times[0] << "," << heights[1]
+         << "," << times[1] << endl;
+}
+
+void bench_build(const vector<string> &keys) {
+    vector<string> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    cout << "type\tinsert_height,insert_time,build_height,build_time" << endl;
+    bench_build_one("rb", T_RB, rb_tree_insert, sorted);
+    bench_build_one("avl", T_AVL, avl_insert, sorted);
+    bench_build_one("treap", T_TREAP, treap_insert, sorted);
+}
+
+void drop_node(struct tree_node *n, void *ctx) {
+    free_node(n);
+}
+
+// merge m keys into a tree of n: tree_union vs. one insert per key
+void bench_merge(const vector<string> &keys) {
+    cout << "type\tn,m,insert_time,union_time" << endl;
+    size_t n = keys.size() / 2;
+    for (size_t m = std::max<size_t>(n / 1000, 1); m <= n; m *= 10) {
+        long times[2];
+        for (int use_union = 0; use_union < 2; use_union++) {
+            struct tree big = T_INITIAL, small = T_INITIAL;
+            big.type = small.type = T_RB;
+            big.key_less = small.key_less = less;
+            for (size_t i = 0; i < n; i++) {
+                rb_tree_insert(&big, new_node(keys[2 * i]));
+            }
+            for (size_t i = 0; i < m; i++) {
+                rb_tree_insert(&small, new_node(keys[2 * i + 1]));
+            }
+            auto start = high_resolution_clock::now();
+            if (use_union) {
+                tree_union(&big, &small, drop_node, NULL);
+            } else {
+                while (small.root != t_nil) {
+                    struct tree_node *x = small.root;
+                    rb_tree_delete(&small, x);
+                    if (rb_tree_insert(&big, x) != x)
+                        free_node(x);
+                }
+            }
+            auto end = high_resolution_clock::now();
+            times[use_union] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            free_tree(&big);
+        }
+        cout << "rb\t" << n << "," << m << "," << times[0] << "," << times[1] << endl;
+    }
+}
+
+// fork-join set operations and bulk build from 1 to all hardware threads
+void bench_par(const vector<string> &keys) {
+    vector<string> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = keys.size();
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    const char *ops[] = {"union", "intersection", "difference", "build"};
+    cout << "type\top,threads,time,speedup" << endl;
+    for (int op = 0; op < 4; op++) {
+        long base = 0;
+        for (int threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+            struct par_pool *pool = par_pool_create(threads);
+            struct tree a = T_INITIAL, b = T_INITIAL;
+            a.type = b.type = T_RB;
+            a.key_less = b.key_less = less;
+            vector<struct tree_node*> nodes;
+            if (op == 3) {
+                for (auto &key: sorted) {
+                    nodes.push_back(new_node(key));
+                }
+            } else {
+                // a holds the first two thirds, b the last two thirds
+                for (size_t i = 0; i < n * 2 / 3; i++) {
+                    rb_tree_insert(&a, new_node(keys[i]));
+                }
+                for (size_t i = n / 3; i < n; i++) {
+                    rb_tree_insert(&b, new_node(keys[i]));
+                }
+            }
+
+            auto start = high_resolution_clock::now();
+            if (op == 0)
+                tree_par_union(pool, &a, &b, drop_node, NULL);
+            else if (op == 1)
+                tree_par_intersection(pool, &a, &b, drop_node, NULL);
+            else if (op == 2)
+                tree_par_difference(pool, &a, &b, drop_node, NULL);
+            else
+                tree_par_build_sorted(pool, &a, nodes.data(), nodes.size());
+            auto end = high_resolution_clock::now();
+            long time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            if (threads == 1)
+                base = time;
+
+            free_tree(&a);
+            par_pool_destroy(pool);
+            cout << "rb\t" << ops[op] << "," << threads << "," << time << ","
+                 << static_cast<double>(base) / time << endl;
+            if (threads == max_threads)
+                break;
+        }
+    }
+}
+
+// binary trees vs. the cache-line sized B+-tree behind the same tree_* calls
+void bench_btree_one(const char *name, enum rb_tree_type type,
+                     const vector<string> &keys) {
+    struct tree t = T_INITIAL;
+    t.type = type;
+    t.key_less = less;
+    t.key_cmp = cmp;
+
+    auto start = high_resolution_clock::now();
+    for (auto &key: keys) {
+        tree_insert(&t, new_node(key));
+    }
+    auto end = high_resolution_clock::now();
+    auto insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    int height = tree_height(&t, t.root);
+
+    size_t found = 0;
+    start = high_resolution_clock::now();
+    for (auto &key: keys) {
+        found += tree_search(&t, const_cast<string*>(&key)) != t_nil;
+    }
+    end = high_resolution_clock::now();
+    auto search_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(found == keys.size());
+
+    size_t walked = 0;
+    start = high_resolution_clock::now();
+    for (auto x = tree_min(&t, t.root); x != t_nil; x = tree_successor(&t, x)) {
+        walked++;
+    }
+    end = high_resolution_clock::now();
+    auto walk_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(walked == keys.size());
+
+    start = high_resolution_clock::now();
+    for (auto &key: keys) {
+        auto x = tree_search(&t, const_cast<string*>(&key));
+        tree_delete(&t, x);
+        free_node(x);
+    }
+    end = high_resolution_clock::now();
+    auto delete_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    cout << name << "\t" << height << "," << insert_time << "," << search_time << ","
+         << walk_time << "," << delete_time << endl;
+}
+
+void bench_btree(const vector<string> &keys) {
+    cout << "type\theight,insert_time,search_time,walk_time,delete_time" << endl;
+    bench_btree_one("rb", T_RB, keys);
+    bench_btree_one("avl", T_AVL, keys);
+    bench_btree_one("btree", T_BTREE, keys);
+}
+
+int long_less(void *a, void *b) {
+    return reinterpret_cast<long>(a) < reinterpret_cast<long>(b);
+}
+
+// (void *)(long) keys: comparator calls vs. int_keys, binary trees vs. btree
+void bench_intkey_one(const char *name, enum rb_tree_type type, bool int_keys,
+                      const vector<long> &keys, const vector<long> &probes) {
+    struct tree t = T_INITIAL;
+    t.type = type;
+    t.key_less = long_less;
+    t.int_keys = int_keys;
+    vector<struct tree_node> nodes(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        nodes[i].key = reinterpret_cast<void*>(keys[i]);
+        tree_insert(&t, &nodes[i]);
+    }
+
+    size_t found = 0;
+    auto start = high_resolution_clock::now();
+    for (auto key: keys) {
+        found += tree_search(&t, reinterpret_cast<void*>(key)) != t_nil;
+    }
+    auto end = high_resolution_clock::now();
+    auto search_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(found == keys.size());
+
+    size_t hits = 0;
+    start = high_resolution_clock::now();
+    for (auto key: probes) {
+        hits += tree_lower_bound(&t, reinterpret_cast<void*>(key)) != t_nil;
+    }
+    end = high_resolution_clock::now();
+    auto bound_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(hits + 1 == probes.size());  // only the largest key has no bound
+
+    cout << name << "\t" << search_time << "," << bound_time << endl;
+    if (type == T_BTREE)
+        btree_destroy(&t);
+}
+
+void bench_intkey(size_t n) {
+    std::uniform_int_distribution<long> dist(0, 1L << 40);
+    set<long> s;
+    while (s.size() < n) {
+        s.insert(dist(rng) * 2);
+    }
+    vector<long> keys(s.begin(), s.end()), probes;
+    std::shuffle(keys.begin(), keys.end(), rng);
+    for (auto key: keys) {
+        probes.push_back(key + 1);  // always a miss, lands between keys
+    }
+    cout << "type\tsearch_time,lower_bound_time" << endl;
+    bench_intkey_one("rb", T_RB, false, keys, probes);
+    bench_intkey_one("rb-int", T_RB, true, keys, probes);
+    bench_intkey_one("btree", T_BTREE, false, keys, probes);
+    bench_intkey_one("btree-int", T_BTREE, true, keys, probes);
+}
+
+// lookups/s on one shared rb tree: mutex around tree_search vs. tree_rw,
+// with readers alone and with one writer deleting and reinserting keys
+long bench_rw_one(bool locked, bool writer, int readers,
+                  const vector<string> &keys) {
+    struct tree t = T_INITIAL;
+    t.type = T_RB;
+    t.key_less = less;
+    t.key_cmp = cmp;
+    struct tree_rw rw;
+    tree_rw_init(&rw, &t);
+    std::mutex lock;
+    vector<struct tree_node*> nodes;
+    for (auto &key: keys) {
+        nodes.push_back(new_node(key));
+        tree_rw_insert(&rw, nodes.back());
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<long> total(0);
+    vector<std::thread> threads;
+    for (int i = 0; i < readers; i++) {
+        threads.emplace_back([&, i]() {
+            struct tree_rw_reader r;
+            tree_rw_reader_register(&rw, &r);
+            size_t j = keys.size() / readers * i;
+            long n = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                void *key = const_cast<string*>(&keys[j]);
+                struct tree_node *x;
+                if (locked) {
+                    std::lock_guard<std::mutex> g(lock);
+                    x = tree_search(&rw.t, key);
+                } else {
+                    tree_rw_read_begin(&rw, &r);
+                    x = tree_rw_search(&rw, key);
+                    tree_rw_read_end(&r);
+                }
+                (void)x;
+                n++;
+                if (++j == keys.size())
+                    j = 0;
+            }
+            tree_rw_reader_unregister(&rw, &r);
+            total += n;
+        });
+    }
+    if (writer) {
+        threads.emplace_back([&]() {
+            std::uniform_int_distribution<size_t> pick(0, nodes.size() - 1);
+            std::mt19937 wrng(1);
+            while (!stop.load(std::memory_order_relaxed)) {
+                struct tree_node *x = nodes[pick(wrng)];
+                if (locked) {
+                    std::lock_guard<std::mutex> g(lock);
+                    tree_delete(&rw.t, x);
+                    tree_insert(&rw.t, x);
+                } else {
+                    tree_rw_delete(&rw, x);
+                    tree_rw_synchronize(&rw);
+                    tree_rw_insert(&rw, x);
+                }
+            }
+        });
+    }
+    const int ms = 300;
+    std::this_thread::sleep_for(milliseconds(ms));
+    stop = true;
+    for (auto &th: threads) {
+        th.join();
+    }
+    free_tree(&rw.t);
+    tree_rw_destroy(&rw);
+    return total * 1000 / ms;
+}
+
+void bench_rw(const vector<string> &keys) {
+    int max_threads = std::max(4u, std::thread::hardware_concurrency());
+    cout << "type\twriter,readers,lookups_per_sec" << endl;
+    for (int writer = 0; writer < 2; writer++) {
+        for (int readers = 1; readers <= max_threads; readers *= 2) {
+            cout << "mutex\t" << writer << "," << readers << ","
+                 << bench_rw_one(true, writer, readers, keys) << endl;
+            cout << "rw\t" << writer << "," << readers << ","
+                 << bench_rw_one(false, writer, readers, keys) << endl;
+        }
+    }
+}
+
+// ranks 0..n-1 with P(i) ~ 1 / (i + 1)^s; s == 0 is uniform
+struct zipf_gen {
+    vector<double> cdf;
+    zipf_gen(size_t n, double s) : cdf(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+            cdf[i] = sum;
+        }
+        for (auto &c: cdf) {
+            c /= sum;
+        }
+    }
+    template <class Rng>
+    size_t operator()(Rng &r) const {
+        double u = std::uniform_real_distribution<double>(0, 1)(r);
+        size_t i = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return std::min(i, cdf.size() - 1);
+    }
+};
+
+// write-heavy mix (half inserts, half deletes) on n keys, half present at
+// start: locked rb tree vs. the lock-free skip list
+long bench_skiplist_one(bool locked, int threads, const zipf_gen &zipf,
+                        const vector<long> &keys) {
+    struct tree t = T_INITIAL;
+    t.type = T_RB;
+    t.int_keys = 1;
+    struct skiplist sl;
+    skiplist_init(&sl, &t);
+    std::mutex lock;
+    struct skiplist_thread init;
+    skiplist_thread_register(&sl, &init);
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        void *key = reinterpret_cast<void*>(keys[i]);
+        if (locked) {
+            struct tree_node *z = static_cast<struct tree_node*>(malloc(sizeof(*z)));
+            z->key = key;
+            tree_insert(&t, z);
+        } else {
+            skiplist_enter(&sl, &init);
+            skiplist_insert(&sl, &init, key, NULL);
+            skiplist_exit(&init);
+        }
+    }
+    skiplist_thread_unregister(&sl, &init);
+
+    std::atomic<bool> stop(false);
+    std::atomic<long> total(0);
+    vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back([&, i]() {
+            std::mt19937 wrng(i + 1);
+            struct skiplist_thread th;
+            skiplist_thread_register(&sl, &th);
+            long n = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                void *key = reinterpret_cast<void*>(keys[zipf(wrng)]);
+                bool insert = wrng() & 1;
+                if (locked) {
+                    std::lock_guard<std::mutex> g(lock);
+                    struct tree_node *x = tree_search(&t, key);
+                    if (insert && x == t_nil) {
+                        x = static_cast<struct tree_node*>(malloc(sizeof(*x)));
+                        x->key = key;
+                        tree_insert(&t, x);
+                    } else if (!insert && x != t_nil) {
+                        tree_delete(&t, x);
+                        free(x);
+                    }
+                } else {
+                    skiplist_enter(&sl, &th);
+                    if (insert)
+                        skiplist_insert(&sl, &th, key, NULL);
+                    else
+                        skiplist_delete(&sl, &th, key, NULL);
+                    skiplist_exit(&th);
+                }
+                n++;
+            }
+            skiplist_thread_unregister(&sl, &th);
+            total += n;
+        });
+    }
+    const int ms = 300;
+    std::this_thread::sleep_for(milliseconds(ms));
+    stop = true;
+    for (auto &w: workers) {
+        w.join();
+    }
+    for (auto x = tree_min(&t, t.root); x != t_nil; ) {
+        auto next = tree_successor(&t, x);
+        tree_delete(&t, x);
+        free(x);
+        x = next;
+    }
+    skiplist_destroy(&sl);
+    return total * 1000 / ms;
+}
+
+// correctness under contention, not speed: every thread inserts, deletes
+// and looks up the same n keys, so tall nodes are often deleted while
+// still being linked, and each entry found is read back. Build with
+// make ASAN=1 to catch an entry freed while still reachable
+bool stress_skiplist(size_t n) {
+    struct tree t = T_INITIAL;
+    t.int_keys = 1;
+    struct skiplist sl;
+    skiplist_init(&sl, &t);
+    int threads = std::max(4u, std::thread::hardware_concurrency());
+    std::atomic<bool> stop(false), bad(false);
+    vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back([&, i]() {
+            std::mt19937 wrng(i + 1);
+            struct skiplist_thread th;
+            skiplist_thread_register(&sl, &th);
+            while (!stop.load(std::memory_order_relaxed)) {
+                long k = static_cast<long>(wrng() % n);
+                void *key = reinterpret_cast<void*>(k);
+                void *data;
+                struct skiplist_node *x;
+                skiplist_enter(&sl, &th);
+                switch (wrng() % 3) {
+                    case 0:
+                        x = skiplist_insert(&sl, &th, key, key);
+                        if (x->data != key)
+                            bad = true;
+                        break;
+                    case 1:
+                        if (skiplist_delete(&sl, &th, key, &data) && data != key)
+                            bad = true;
+                        break;
+                    default:
+                        for (x = skiplist_lower_bound(&sl, key); x; x = skiplist_successor(&sl, x)) {
+                            if (x->data != x->key)
+                                bad = true;
+                        }
+                }
+                skiplist_exit(&th);
+            }
+            skiplist_thread_unregister(&sl, &th);
+        });
+    }
+    std::this_thread::sleep_for(milliseconds(2000));
+    stop = true;
+    for (auto &w: workers) {
+        w.join();
+    }
+    long prev = -1;
+    for (auto x = skiplist_min(&sl); x; x = skiplist_successor(&sl, x)) {
+        long k = reinterpret_cast<long>(x->key);
+        if (k <= prev || k >= static_cast<long>(n))
+            bad = true;
+        prev = k;
+    }
+    skiplist_destroy(&sl);
+    cout << "skiplist_stress	" << n << "," << threads << "," << (bad ? "FAIL" : "ok") << endl;
+    return !bad;
+}
+
+void bench_skiplist(size_t n) {
+    vector<long> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = static_cast<long>(i);
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);  // hot ranks spread over the key space
+    int max_threads = std::max(4u, std::thread::hardware_concurrency());
+    cout << "type\tzipf_s,threads,ops_per_sec" << endl;
+    for (double s: {0.0, 0.99}) {
+        zipf_gen zipf(n, s);
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            cout << "rb-mutex\t" << s << "," << threads << ","
+                 << bench_skiplist_one(true, threads, zipf, keys) << endl;
+            cout << "skiplist\t" << s << "," << threads << ","
+                 << bench_skiplist_one(false, threads, zipf, keys) << endl;
+        }
+    }
+}
+
+// mutable rb tree (a snapshot is a full copy) vs. the persistent tree, with
+// no snapshots held and with a fresh snapshot held across every update
+void bench_persist(size_t n) {
+    vector<long> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = static_cast<long>(i);
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);
+    cout << "type\tinsert_time,delete_time,snapshot_time" << endl;
+
+    struct tree t = T_INITIAL;
+    t.type = T_RB;
+    t.int_keys = 1;
+    auto start = high_resolution_clock::now();
+    for (auto key: keys) {
+        struct tree_node *z = static_cast<struct tree_node*>(malloc(sizeof(*z)));
+        z->key = reinterpret_cast<void*>(key);
+        tree_insert(&t, z);
+    }
+    auto end = high_resolution_clock::now();
+    auto insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    start = high_resolution_clock::now();
+    struct tree copy = t;
+    copy.root = t_nil;
+    vector<struct tree_node*> nodes;
+    for (auto x = tree_min(&t, t.root); x != t_nil; x = tree_successor(&t, x)) {
+        struct tree_node *z = static_cast<struct tree_node*>(malloc(sizeof(*z)));
+        z->key = x->key;
+        nodes.push_back(z);
+    }
+    tree_build_sorted(&copy, nodes.data(), nodes.size());
+    end = high_resolution_clock::now();
+    auto snapshot_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    for (auto z: nodes) {
+        free(z);
+    }
+
+    start = high_resolution_clock::now();
+    for (auto key: keys) {
+        auto x = tree_search(&t, reinterpret_cast<void*>(key));
+        tree_delete(&t, x);
+        free(x);
+    }
+    end = high_resolution_clock::now();
+    auto delete_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    cout << "rb\t" << insert_time << "," << delete_time << "," << snapshot_time << endl;
+
+    for (int snapshots = 0; snapshots < 2; snapshots++) {
+        struct ptree pt, snap;
+        ptree_init(&pt, &t);
+        ptree_init(&snap, &t);
+        start = high_resolution_clock::now();
+        for (auto key: keys) {
+            if (snapshots) {
+                ptree_destroy(&snap);
+                ptree_snapshot(&snap, &pt);
+            }
+            ptree_insert(&pt, reinterpret_cast<void*>(key), NULL);
+        }
+        end = high_resolution_clock::now();
+        insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+        const int rounds = 1000;
+        start = high_resolution_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            ptree_destroy(&snap);
+            ptree_snapshot(&snap, &pt);
+        }
+        end = high_resolution_clock::now();
+        snapshot_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / rounds;
+        if (!snapshots)
+            ptree_destroy(&snap);
+
+        start = high_resolution_clock::now();
+        for (auto key: keys) {
+            if (snapshots) {
+                ptree_destroy(&snap);
+                ptree_snapshot(&snap, &pt);
+            }
+            ptree_delete(&pt, reinterpret_cast<void*>(key), NULL);
+        }
+        end = high_resolution_clock::now();
+        delete_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        ptree_destroy(&snap);
+        ptree_destroy(&pt);
+        cout << (snapshots ? "ptree-snap\t" : "ptree\t") << insert_time << ","
+             << delete_time << "," << snapshot_time << endl;
+    }
+}
+
+const void *string_bytes(void *p, size_t *len, void *ctx) {
+    auto str = static_cast<string*>(p);
+    *len = str->size();
+    return str->data();
+}
+
+// restart cost: rebuild the rb tree from the keys vs. mmap a tree_file;
+// ready_time runs until the first lookup has answered
+void bench_file(const vector<string> &keys) {
+    const char *path = "benchmark.tree";
+    cout << "type\tready_time,search_time" << endl;
+
+    auto start = high_resolution_clock::now();
+    struct tree t = T_INITIAL;
+    t.type = T_RB;
+    t.key_less = less;
+    t.key_cmp = cmp;
+    for (auto &key: keys) {
+        rb_tree_insert(&t, new_node(key));
+    }
+    bool found = tree_search(&t, const_cast<string*>(&keys[0])) != t_nil;
+    auto end = high_resolution_clock::now();
+    auto ready_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(found);
+
+    start = high_resolution_clock::now();
+    for (auto &key: keys) {
+        found &= tree_search(&t, const_cast<string*>(&key)) != t_nil;
+    }
+    end = high_resolution_clock::now();
+    auto search_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(found);
+    cout << "rb-rebuild\t" << ready_time << "," << search_time << endl;
+
+    start = high_resolution_clock::now();
+    int err = tree_file_write(path, &t, string_bytes, NULL, NULL);
+    end = high_resolution_clock::now();
+    assert(!err);
+    auto write_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    free_tree(&t);
+
+    struct tree_file f;
+    start = high_resolution_clock::now();
+    err = tree_file_open(&f, path, 0);
+    assert(!err);
+    found = tree_file_find(&f, keys[0].data(), keys[0].size()) >= 0;
+    end = high_resolution_clock::now();
+    ready_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(found);
+
+    start = high_resolution_clock::now();
+    for (auto &key: keys) {
+        found &= tree_file_find(&f, key.data(), key.size()) >= 0;
+    }
+    end = high_resolution_clock::now();
+    search_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(found);
+    cout << "mmap\t" << ready_time << "," << search_time << endl;
+    cout << "write\t" << f.size << " bytes," << write_time << endl;
+    tree_file_close(&f);
+    unlink(path);
+}
+
+struct tree_node *dump_string_node(const void *key, size_t klen, const void *data,
+                                   size_t dlen, void *ctx) {
+    return new_node(string(static_cast<const char*>(key), klen));
+}
+
+void drop_string_node(struct tree_node *n, void *ctx) {
+    free_node(n);
+}
+
+// checkpoint throughput of the rb tree, plain and prefix-encoded, against
+// rebuilding it with one insert per key; the dump goes through the page
+// cache, so the times are an upper bound on what the disk will allow
+void bench_dump(const vector<string> &keys) {
+    const char *path = "benchmark.dump";
+    cout << "type\tbytes,save_time,load_time,save_MBps,load_MBps" << endl;
+
+    auto start = high_resolution_clock::now();
+    struct tree t = T_INITIAL;
+    t.type = T_RB;
+    t.key_less = less;
+    t.key_cmp = cmp;
+    for (auto &key: keys) {
+        rb_tree_insert(&t, new_node(key));
+    }
+    auto end = high_resolution_clock::now();
+    auto insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    cout << "rb-insert\t0,0," << insert_time << ",0,0" << endl;
+
+    for (int flags = 0; flags <= TREE_DUMP_PREFIX; flags++) {
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        assert(fd >= 0);
+        start = high_resolution_clock::now();
+        long long bytes = tree_dump_save(fd, &t, string_bytes, NULL, NULL, flags);
+        end = high_resolution_clock::now();
+        assert(bytes > 0);
+        auto save_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+        struct tree u = T_INITIAL;
+        u.type = T_RB;
+        u.key_less = less;
+        u.key_cmp = cmp;
+        lseek(fd, 0, SEEK_SET);
+        start = high_resolution_clock::now();
+        long long loaded = tree_dump_load(fd, &u, dump_string_node, drop_string_node, NULL);
+        end = high_resolution_clock::now();
+        assert(loaded == bytes);
+        auto load_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        close(fd);
+        bool found = true;
+        for (auto &key: keys) {
+            found &= tree_search(&u, const_cast<string*>(&key)) != t_nil;
+        }
+        assert(found);
+        free_tree(&u);
+        cout << (flags ? "dump-prefix\t" : "dump\t") << bytes << "," << save_time << ","
+             << load_time << "," << bytes * 1e3 / save_time << ","
+             << bytes * 1e3 / load_time << endl;
+    }
+    free_tree(&t);
+    unlink(path);
+}
+
+// edit-buffer workload on n elements: inserts and 16-element erases at
+// random positions, reverses of random ranges and random reads, implicit
+// treap vs. std::vector
+void bench_seq(size_t n) {
+    n = std::max<size_t>(n, 16);
+    // the erases must leave something behind
+    const size_t ops = std::min<size_t>(10000, n / 16);
+    vector<long> init(n);
+    for (size_t i = 0; i < n; i++) {
+        init[i] = static_cast<long>(i);
+    }
+    vector<size_t> pos(ops), len(ops);
+    for (size_t i = 0; i < ops; i++) {
+        pos[i] = rng() % (n + 1);
+        len[i] = rng() % (n + 1);
+    }
+    cout << "type\tinsert_time,erase_time,reverse_time,get_time" << endl;
+
+    vector<long> v(init);
+    auto start = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        v.insert(v.begin() + pos[i] % (v.size() + 1), static_cast<long>(i));
+    }
+    auto end = high_resolution_clock::now();
+    auto insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    start = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        size_t lo = pos[i] % (v.size() - 15);
+        v.erase(v.begin() + lo, v.begin() + lo + 16);
+    }
+    end = high_resolution_clock::now();
+    auto erase_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    start = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        size_t lo = pos[i] % v.size(), hi = len[i] % v.size();
+        std::reverse(v.begin() + std::min(lo, hi), v.begin() + std::max(lo, hi));
+    }
+    end = high_resolution_clock::now();
+    auto reverse_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    long sum = 0;
+    start = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        sum += v[pos[i] % v.size()];
+    }
+    end = high_resolution_clock::now();
+    auto get_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    cout << "vector\t" << insert_time << "," << erase_time << "," << reverse_time << ","
+         << get_time << endl;
+
+    struct seq s;
+    seq_init(&s);
+    seq_build(&s, init.data(), n);
+    start = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        seq_insert(&s, pos[i] % (seq_size(&s) + 1), static_cast<long>(i));
+    }
+    end = high_resolution_clock::now();
+    insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    start = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        size_t lo = pos[i] % (seq_size(&s) - 15);
+        seq_erase(&s, lo, lo + 16);
+    }
+    end = high_resolution_clock::now();
+    erase_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    start = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        size_t lo = pos[i] % seq_size(&s), hi = len[i] % seq_size(&s);
+        seq_reverse(&s, std::min(lo, hi), std::max(lo, hi));
+    }
+    end = high_resolution_clock::now();
+    reverse_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    long seq_sum = 0;
+    start = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        seq_sum += seq_get(&s, pos[i] % seq_size(&s));
+    }
+    end = high_resolution_clock::now();
+    get_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(seq_sum == sum);
+    seq_destroy(&s);
+    cout << "seq-treap\t" << insert_time << "," << erase_time << "," << reverse_time << ","
+         << get_time << endl;
+}
+
+long data_value(struct tree_node *x) {
+    return reinterpret_cast<long>(x->data);
+}
+
+long sum_combine(long a, long b) {
+    return a + b;
+}
+
+// sum of the values in a key range: tree_aggregate vs. walking the range
+// with tree_successor, on ranges of a few widths; plus what keeping the
+// aggregates costs the inserts
+void bench_agg(const vector<string> &keys) {
+    vector<string> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    cout << "type\tinsert_time" << endl;
+    struct tree t = T_INITIAL;
+    for (int augmented = 0; augmented < 2; augmented++) {
+        t = T_INITIAL;
+        t.type = T_RB;
+        t.key_less = less;
+        t.key_cmp = cmp;
+        if (augmented) {
+            t.agg_value = data_value;
+            t.agg_combine = sum_combine;
+        }
+        vector<struct tree_node*> nodes;
+        for (size_t i = 0; i < keys.size(); i++) {
+            nodes.push_back(new_node(keys[i], augmented));
+            nodes.back()->data = reinterpret_cast<void*>(static_cast<long>(i % 1000));
+        }
+        auto start = high_resolution_clock::now();
+        for (auto n: nodes) {
+            tree_insert(&t, n);
+        }
+        auto end = high_resolution_clock::now();
+        auto insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        cout << (augmented ? "rb-agg\t" : "rb\t") << insert_time << endl;
+        if (!augmented) {
+            free_tree(&t);
+        }
+    }
+
+    const size_t queries = 200;
+    cout << "width\tagg_time,scan_time" << endl;
+    for (size_t width: {size_t(16), size_t(1024), sorted.size() / 8}) {
+        if (width == 0 || width > sorted.size()) {
+            continue;
+        }
+        vector<size_t> from(queries);
+        for (auto &f: from) {
+            f = rng() % (sorted.size() - width + 1);
+        }
+        long agg_sum = 0, scan_sum = 0;
+        auto start = high_resolution_clock::now();
+        for (auto f: from) {
+            long out;
+            if (tree_aggregate(&t, &sorted[f], &sorted[f + width - 1], &out))
+                agg_sum += out;
+        }
+        auto end = high_resolution_clock::now();
+        auto agg_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        start = high_resolution_clock::now();
+        for (auto f: from) {
+            string *hi = &sorted[f + width - 1];
+            for (struct tree_node *x = tree_lower_bound(&t, &sorted[f]);
+                 x != t_nil && !less(hi, x->key); x = tree_successor(&t, x)) {
+                scan_sum += data_value(x);
+            }
+        }
+        end = high_resolution_clock::now();
+        auto scan_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        assert(agg_sum == scan_sum);
+        cout << width << "\t" << agg_time << "," << scan_time << endl;
+    }
+    free_tree(&t);
+}
+
+int count_hit(struct interval *iv, void *ctx) {
+    *static_cast<long*>(ctx) += iv->hi - iv->lo;
+    return 0;
+}
+
+// stabbing queries on n intervals, about ten hits each: interval tree vs.
+// a linear scan vs. an offline sweep over intervals and queries sorted by
+// position, which keeps the intervals open at the current point in a vector
+void bench_interval(size_t n) {
+    const long span = 100000000;
+    const size_t queries = 2000;
+    std::uniform_int_distribution<long> pos(0, span), len(0, 20 * span / std::max<long>(n, 1));
+    vector<struct interval> ivs(n);
+    for (auto &iv: ivs) {
+        iv.lo = pos(rng);
+        iv.hi = iv.lo + len(rng);
+    }
+    vector<long> points(queries);
+    for (auto &x: points) {
+        x = pos(rng);
+    }
+    cout << "type\tbuild_time,query_time,hits" << endl;
+
+    struct tree t;
+    itree_init(&t);
+    auto start = high_resolution_clock::now();
+    for (auto &iv: ivs) {
+        itree_insert(&t, &iv);
+    }
+    auto end = high_resolution_clock::now();
+    auto build_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    long tree_hits = 0;
+    start = high_resolution_clock::now();
+    for (auto x: points) {
+        itree_stab(&t, x, count_hit, &tree_hits);
+    }
+    end = high_resolution_clock::now();
+    auto query_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    cout << "itree\t" << build_time << "," << query_time << "," << tree_hits << endl;
+
+    long scan_hits = 0;
+    start = high_resolution_clock::now();
+    for (auto x: points) {
+        for (auto &iv: ivs) {
+            if (iv.lo <= x && x <= iv.hi)
+                scan_hits += iv.hi - iv.lo;
+        }
+    }
+    end = high_resolution_clock::now();
+    query_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(scan_hits == tree_hits);
+    cout << "scan\t0," << query_time << "," << scan_hits << endl;
+
+    start = high_resolution_clock::now();
+    vector<std::pair<long, long>> sorted;
+    for (auto &iv: ivs) {
+        sorted.emplace_back(iv.lo, iv.hi);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    end = high_resolution_clock::now();
+    build_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    long sweep_hits = 0;
+    start = high_resolution_clock::now();
+    vector<long> order(points);
+    std::sort(order.begin(), order.end());
+    vector<std::pair<long, long>> open;
+    size_t next = 0;
+    for (auto x: order) {
+        for (; next < sorted.size() && sorted[next].first <= x; next++) {
+            open.push_back(sorted[next]);
+        }
+        size_t kept = 0;
+        for (auto &iv: open) {
+            if (iv.second >= x) {
+                open[kept++] = iv;
+                sweep_hits += iv.second - iv.first;
+            }
+        }
+        open.resize(kept);
+    }
+    end = high_resolution_clock::now();
+    query_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(sweep_hits == tree_hits);
+    cout << "sweep\t" << build_time << "," << query_time << "," << sweep_hits << endl;
+}
+
+// node footprint and speed: struct tree_node rb/avl trees vs. the compact
+// index-linked ctree, on n integer keys searched in random order
+void bench_compact(size_t n) {
+    vector<long> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = static_cast<long>(i) * 2;
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);
+    vector<long> probes(keys);
+    std::shuffle(probes.begin(), probes.end(), rng);
+    cout << "type\tbytes_per_entry,reserved_bytes_per_entry,insert_time,search_time" << endl;
+
+    for (auto type: {T_RB, T_AVL}) {
+        struct tree t = T_INITIAL;
+        t.type = type;
+        t.int_keys = 1;
+        vector<struct tree_node> nodes(n);
+        auto start = high_resolution_clock::now();
+        for (size_t i = 0; i < n; i++) {
+            nodes[i].key = reinterpret_cast<void*>(keys[i]);
+            tree_insert(&t, &nodes[i]);
+        }
+        auto end = high_resolution_clock::now();
+        auto insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        size_t found = 0;
+        start = high_resolution_clock::now();
+        for (auto key: probes) {
+            found += tree_search(&t, reinterpret_cast<void*>(key)) != t_nil;
+        }
+        end = high_resolution_clock::now();
+        auto search_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        assert(found == n);
+        cout << (type == T_RB ? "rb\t" : "avl\t") << sizeof(struct tree_node) << ","
+             << sizeof(struct tree_node) << "," << insert_time << "," << search_time << endl;
+
+        struct ctree ct;
+        ctree_init(&ct, &t);
+        start = high_resolution_clock::now();
+        for (auto key: keys) {
+            ctree_insert(&ct, reinterpret_cast<void*>(key), NULL);
+        }
+        end = high_resolution_clock::now();
+        insert_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        found = 0;
+        start = high_resolution_clock::now();
+        for (auto key: probes) {
+            found += ctree_search(&ct, reinterpret_cast<void*>(key)) != NULL;
+        }
+        end = high_resolution_clock::now();
+        search_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        assert(found == n);
+        // the array grows by doubling; ctree_reserve sizes it exactly
+        double grown = static_cast<double>(ctree_bytes(&ct)) / n;
+        ctree_destroy(&ct);
+        ctree_init(&ct, &t);
+        ctree_reserve(&ct, n);
+        for (auto key: keys) {
+            ctree_insert(&ct, reinterpret_cast<void*>(key), NULL);
+        }
+        double reserved = static_cast<double>(ctree_bytes(&ct)) / n;
+        ctree_destroy(&ct);
+        cout << (type == T_RB ? "ctree-rb\t" : "ctree-avl\t") << grown << "," << reserved
+             << "," << insert_time << "," << search_time << endl;
+    }
+}
+
+// one lookup at a time vs. tree_search_batch over runs of 256 keys, on a
+// tree whose nodes lie scattered across memory
+void bench_batch_one(const char *name, enum rb_tree_type type, bool int_keys,
+                     const vector<void*> &keys) {
+    const size_t batch = 256;
+    struct tree t = T_INITIAL;
+    t.type = type;
+    t.int_keys = int_keys;
+    t.key_less = less;
+    t.key_cmp = cmp;
+    size_t n = keys.size();
+    vector<struct tree_node> nodes(n);
+    vector<size_t> slots(n);
+    for (size_t i = 0; i < n; i++) {
+        slots[i] = i;
+    }
+    std::shuffle(slots.begin(), slots.end(), rng);
+    for (size_t i = 0; i < n; i++) {
+        nodes[slots[i]].key = keys[i];
+        tree_insert(&t, &nodes[slots[i]]);
+    }
+    vector<void*> probes(keys);
+    std::shuffle(probes.begin(), probes.end(), rng);
+
+    size_t found = 0;
+    auto start = high_resolution_clock::now();
+    for (auto key: probes) {
+        found += tree_search(&t, key) != t_nil;
+    }
+    auto end = high_resolution_clock::now();
+    auto search_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(found == n);
+
+    vector<struct tree_node*> out(batch);
+    found = 0;
+    start = high_resolution_clock::now();
+    for (size_t i = 0; i < n; i += batch) {
+        size_t m = std::min(batch, n - i);
+        tree_search_batch(&t, &probes[i], m, out.data());
+        for (size_t j = 0; j < m; j++) {
+            found += out[j] != t_nil && out[j]->key == probes[i + j];
+        }
+    }
+    end = high_resolution_clock::now();
+    auto batch_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    assert(found == n);
+    cout << name << "\t" << search_time << "," << batch_time << ","
+         << static_cast<double>(search_time) / batch_time << endl;
+    if (type == T_BTREE)
+        btree_destroy(&t);
+}
+
+void bench_batch(size_t n) {
+    vector<void*> ints(n), strs;
+    for (size_t i = 0; i < n; i++) {
+        ints[i] = reinterpret_cast<void*>(static_cast<long>(i) * 2);
+    }
+    std::shuffle(ints.begin(), ints.end(), rng);
+    vector<string> keys = random_keys(n);
+    for (auto &key: keys) {
+        strs.push_back(&key);
+    }
+    cout << "type\tsearch_time,batch_time,speedup" << endl;
+    bench_batch_one("rb-int", T_RB, true, ints);
+    bench_batch_one("avl-int", T_AVL, true, ints);
+    bench_batch_one("btree-int", T_BTREE, true, ints);
+    bench_batch_one("rb-str", T_RB, false, strs);
+    bench_batch_one("avl-str", T_AVL, false, strs);
+}
+
+// ns per key to insert and then delete batches of fresh keys in a tree of
+// n keys: one tree_insert/tree_delete per key vs. the batch calls. The two
+// get different keys, so neither finds the other's path in cache
+void bench_bulk(size_t n) {
+    const size_t total = 65536;
+    vector<long> keys(n + 2 * total);
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = static_cast<long>(i);
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);
+    cout << "type\tbatch,insert_loop,insert_batch,delete_loop,delete_batch" << endl;
+    for (auto type: {T_RB, T_AVL}) {
+        struct tree t = T_INITIAL;
+        t.type = type;
+        t.int_keys = 1;
+        vector<struct tree_node> nodes(keys.size());
+        for (size_t i = 0; i < nodes.size(); i++) {
+            nodes[i].key = reinterpret_cast<void*>(keys[i]);
+        }
+        for (size_t i = 0; i < n; i++) {
+            tree_insert(&t, &nodes[i]);
+        }
+        for (size_t size = 16; size <= total; size *= 16) {
+            long times[4] = {0, 0, 0, 0};
+            vector<struct tree_node*> loop(size), batch(size);
+            for (size_t off = 0; off < total; off += size) {
+                for (size_t i = 0; i < size; i++) {
+                    loop[i] = &nodes[n + off + i];
+                    batch[i] = &nodes[n + total + off + i];
+                }
+                auto t0 = high_resolution_clock::now();
+                for (auto x: loop) {
+                    tree_insert(&t, x);
+                }
+                auto t1 = high_resolution_clock::now();
+                tree_insert_batch(&t, batch.data(), size, NULL, NULL);
+                auto t2 = high_resolution_clock::now();
+                std::shuffle(loop.begin(), loop.end(), rng);
+                std::shuffle(batch.begin(), batch.end(), rng);
+                auto t3 = high_resolution_clock::now();
+                for (auto x: loop) {
+                    tree_delete(&t, x);
+                }
+                auto t4 = high_resolution_clock::now();
+                tree_delete_batch(&t, batch.data(), size);
+                auto t5 = high_resolution_clock::now();
+                times[0] += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+                times[1] += std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+                times[2] += std::chrono::duration_cast<std::chrono::nanoseconds>(t4 - t3).count();
+                times[3] += std::chrono::duration_cast<std::chrono::nanoseconds>(t5 - t4).count();
+            }
+            cout << (type == T_RB ? "rb\t" : "avl\t") << size;
+            for (auto ns: times) {
+                cout << "," << static_cast<double>(ns) / total;
+            }
+            cout << endl;
+        }
+    }
+}
+
+// ns per op from the root vs. from a finger on the previous result, for
+// ascending, random-walk (steps of up to 16 keys) and random lookups, and
+// for inserting ascending keys into an empty tree
+void bench_finger(size_t n) {
+    vector<long> seq(n), walk(n), random(n);
+    for (size_t i = 0; i < n; i++) {
+        seq[i] = static_cast<long>(i) * 2;
+        random[i] = seq[rng() % n];
+    }
+    long pos = n / 2;
+    for (auto &key: walk) {
+        pos = std::min<long>(n - 1, std::max<long>(0, pos + static_cast<long>(rng() % 33) - 16));
+        key = pos * 2;
+    }
+    vector<long> shuffled(seq);
+    std::shuffle(shuffled.begin(), shuffled.end(), rng);
+    cout << "type\tpattern,root_time,finger_time" << endl;
+    for (auto type: {T_RB, T_AVL}) {
+        const char *name = type == T_RB ? "rb" : "avl";
+        struct tree t = T_INITIAL;
+        t.type = type;
+        t.int_keys = 1;
+        vector<struct tree_node> nodes(n);
+        for (size_t i = 0; i < n; i++) {
+            nodes[i].key = reinterpret_cast<void*>(shuffled[i]);
+            tree_insert(&t, &nodes[i]);
+        }
+        for (auto pattern: {"seq", "walk", "random"}) {
+            const vector<long> &keys = pattern[0] == 's' ? seq : pattern[0] == 'w' ? walk : random;
+            size_t found = 0;
+            auto start = high_resolution_clock::now();
+            for (auto key: keys) {
+                found += tree_search(&t, reinterpret_cast<void*>(key)) != t_nil;
+            }
+            auto end = high_resolution_clock::now();
+            auto root_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            struct tree_node *finger = t_nil;
+            start = high_resolution_clock::now();
+            for (auto key: keys) {
+                finger = tree_search_from(&t, finger, reinterpret_cast<void*>(key));
+                found += finger != t_nil;
+            }
+            end = high_resolution_clock::now();
+            auto finger_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            assert(found == 2 * n);
+            cout << name << "\t" << pattern << "," << static_cast<double>(root_time) / n << ","
+                 << static_cast<double>(finger_time) / n << endl;
+        }
+
+        // time-ordered keys: each insert lands right of the previous one
+        struct tree a = T_INITIAL, b = T_INITIAL;
+        a.type = b.type = type;
+        a.int_keys = b.int_keys = 1;
+        vector<struct tree_node> an(n), bn(n);
+        auto start = high_resolution_clock::now();
+        for (size_t i = 0; i < n; i++) {
+            an[i].key = reinterpret_cast<void*>(seq[i]);
+            tree_insert(&a, &an[i]);
+        }
+        auto end = high_resolution_clock::now();
+        auto root_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        struct tree_node *finger = t_nil;
+        start = high_resolution_clock::now();
+        for (size_t i = 0; i < n; i++) {
+            bn[i].key = reinterpret_cast<void*>(seq[i]);
+            finger = tree_insert_from(&b, finger, &bn[i]);
+        }
+        end = high_resolution_clock::now();
+        auto finger_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        cout << name << "\tappend," << static_cast<double>(root_time) / n << ","
+             << static_cast<double>(finger_time) / n << endl;
+    }
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        cout << "USAGE: " << argv[0] << " num-of-keys" << endl;
+    if (argc != 2 && argc != 3) {
+        cout << "USAGE: " << argv[0] << " num-of-keys [cmp|cpp|pool|rank|build|merge|par|btree|intkey|rw|skiplist|skiplist_stress|persist|file|dump|seq|agg|interval|compact|batch|bulk|finger]" << endl;
         return 0;
     }
     int num = atoi(argv[1]);
+    string mode = argc == 3 ? argv[2] : "";
+    if (mode == "intkey") {
+        bench_intkey(num);
+        return 0;
+    }
+    if (mode == "skiplist") {
+        bench_skiplist(num);
+        return 0;
+    }
+    if (mode == "skiplist_stress") {
+        return stress_skiplist(num) ? 0 : 1;
+    }
+    if (mode == "batch") {
+        bench_batch(num);
+        return 0;
+    }
+    if (mode == "bulk") {
+        bench_bulk(num);
+        return 0;
+    }
+    if (mode == "finger") {
+        bench_finger(num);
+        return 0;
+    }
+    if (mode == "seq") {
+        bench_seq(num);
+        return 0;
+    }
+    if (mode == "interval") {
+        bench_interval(num);
+        return 0;
+    }
+    if (mode == "compact") {
+        bench_compact(num);
+        return 0;
+    }
+    if (mode == "persist") {
+        bench_persist(num);
+        return 0;
+    }
     auto r = random_keys(num);
     cout << "key set: " << r.size() << endl;
+    if (mode == "cmp") {
+        bench_cmp(r);
+        return 0;
+    }
+    if (mode == "cpp") {
+        bench_cpp(r);
+        return 0;
+    }
+    if (mode == "pool") {
+        bench_pool(r);
+        return 0;
+    }
+    if (mode == "rank") {
+        bench_rank(r);
+        return 0;
+    }
+    if (mode == "build") {
+        bench_build(r);
+        return 0;
+    }
+    if (mode == "file") {
+        bench_file(r);
+        return 0;
+    }
+    if (mode == "dump") {
+        bench_dump(r);
+        return 0;
+    }
+    if (mode == "agg") {
+        bench_agg(r);
+        return 0;
+    }
+    if (mode == "merge") {
+        bench_merge(r);
+        return 0;
+    }
+    if (mode == "par") {
+        bench_par(r);
+        return 0;
+    }
+    if (mode == "btree") {
+        bench_btree(r);
+        return 0;
+    }
+    if (mode == "rw") {
+        bench_rw(r);
+        return 0;
+    }
     // cout << "type\theight,insert_time,search_time,delete_time" << endl;
     bench_bst(r);
     bench_rb(r);
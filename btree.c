@@ -0,0 +1,568 @@
+#include "trees.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define BTREE_X86 1
+#endif
+
+/*
+ * B+-tree behind T_BTREE.
+ *
+ * Keys are kept in arrays inside 256-byte nodes (four cache lines), so a
+ * search reads a couple of lines per level instead of a whole tree_node
+ * per comparison. Leaves hold the caller's tree_nodes in key order and are
+ * chained for successor/predecessor; each entry's p points back at its
+ * leaf. Inner separators are the minimum key of the subtree to their
+ * right and always point at the key of a live entry.
+ */
+#define BTREE_NODE_BYTES 256
+#define BTREE_MAX 14
+#define BTREE_LEAF_MIN (BTREE_MAX / 2)
+#define BTREE_INNER_MIN ((BTREE_MAX - 1) / 2)
+
+struct btree_node {
+    struct btree_node *parent;
+    int n;          /* keys in use */
+    int leaf;
+    void *keys[BTREE_MAX];
+};
+
+struct btree_leaf {
+    struct btree_node h;
+    struct tree_node *vals[BTREE_MAX];
+    struct btree_leaf *prev, *next;
+};
+
+struct btree_inner {
+    struct btree_node h;
+    struct btree_node *child[BTREE_MAX + 1];
+};
+
+typedef char btree_leaf_fits[sizeof(struct btree_leaf) <= BTREE_NODE_BYTES ? 1 : -1];
+typedef char btree_inner_fits[sizeof(struct btree_inner) <= BTREE_NODE_BYTES ? 1 : -1];
+
+#define LEAF(x) ((struct btree_leaf *)(x))
+#define INNER(x) ((struct btree_inner *)(x))
+#define LEAF_OF(z) ((struct btree_leaf *)(z)->p)
+
+static struct btree_node *btree_alloc(int leaf) {
+    struct btree_node *x = aligned_alloc(64, BTREE_NODE_BYTES);
+    assert(x);
+    memset(x, 0, BTREE_NODE_BYTES);
+    x->leaf = leaf;
+    return x;
+}
+
+/*
+ * int_keys nodes: keys are sorted, so the number of keys below key (or at
+ * most key, if le) is the slot to use. Counted with compare+movemask, four
+ * or two keys at a time. The last load may run past keys[] but stays inside
+ * the 256-byte node; lanes past n are masked off.
+ */
+static int count_scalar(void **keys, int n, long key, int le) {
+    int i, c = 0;
+    for (i = 0; i < n; i++)
+        c += le ? (long)keys[i] <= key : (long)keys[i] < key;
+    return c;
+}
+
+#ifdef BTREE_X86
+__attribute__((target("avx2")))
+static int count_avx2(void **keys, int n, long key, int le) {
+    __m256i k = _mm256_set1_epi64x(key);
+    int i, c = 0;
+    for (i = 0; i < n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(keys + i));
+        /* le: count keys > key and take the rest */
+        __m256i gt = le ? _mm256_cmpgt_epi64(v, k) : _mm256_cmpgt_epi64(k, v);
+        int m = _mm256_movemask_pd(_mm256_castsi256_pd(gt));
+        if (n - i < 4)
+            m &= (1 << (n - i)) - 1;
+        c += __builtin_popcount(m);
+    }
+    return le ? n - c : c;
+}
+
+__attribute__((target("sse4.2")))
+static int count_sse42(void **keys, int n, long key, int le) {
+    __m128i k = _mm_set1_epi64x(key);
+    int i, c = 0;
+    for (i = 0; i < n; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(keys + i));
+        __m128i gt = le ? _mm_cmpgt_epi64(v, k) : _mm_cmpgt_epi64(k, v);
+        int m = _mm_movemask_pd(_mm_castsi128_pd(gt));
+        if (n - i < 2)
+            m &= 1;
+        c += __builtin_popcount(m);
+    }
+    return le ? n - c : c;
+}
+#endif
+
+static int (*count_keys)(void **keys, int n, long key, int le) = count_scalar;
+
+#ifdef BTREE_X86
+/* pick once at load time, so lookups never write shared state */
+__attribute__((constructor))
+static void btree_pick_simd(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        count_keys = count_avx2;
+    else if (__builtin_cpu_supports("sse4.2"))
+        count_keys = count_sse42;
+}
+#endif
+
+/* first i with key < keys[i], i.e. the child to descend into */
+static int node_upper(struct tree *t, struct btree_node *x, void *key) {
+    int lo = 0, hi = x->n;
+    TREE_STAT(visited);
+    if (t->int_keys)
+        return count_keys(x->keys, x->n, (long)key, 1);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (tree_key_cmp(t, key, x->keys[mid]) < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/* first i with keys[i] >= key; *eq is set if keys[i] == key */
+static int node_lower(struct tree *t, struct btree_node *x, void *key, int *eq) {
+    int lo = 0, hi = x->n;
+    TREE_STAT(visited);
+    *eq = 0;
+    if (t->int_keys) {
+        lo = count_keys(x->keys, x->n, (long)key, 0);
+        *eq = lo < x->n && x->keys[lo] == key;
+        return lo;
+    }
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int c = tree_key_cmp(t, key, x->keys[mid]);
+        if (c == 0) {
+            *eq = 1;
+            return mid;
+        }
+        if (c < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+static struct btree_leaf *find_leaf(struct tree *t, void *key) {
+    struct btree_node *x = t->btree;
+    while (!x->leaf)
+        x = INNER(x)->child[node_upper(t, x, key)];
+    return LEAF(x);
+}
+
+static int child_index(struct btree_node *p, struct btree_node *c) {
+    int j = 0;
+    while (INNER(p)->child[j] != c)
+        j++;
+    return j;
+}
+
+static int slot_of(struct btree_leaf *l, struct tree_node *z) {
+    int i = 0;
+    while (l->vals[i] != z)
+        i++;
+    return i;
+}
+
+static inline void set_entry(struct btree_leaf *l, int i, struct tree_node *z) {
+    l->h.keys[i] = z->key;
+    l->vals[i] = z;
+    z->p = (struct tree_node *)l;
+}
+
+struct tree_node *btree_search(struct tree *t, void *key) {
+    assert(t);
+    if (!t->btree)
+        return t_nil;
+    struct btree_leaf *l = find_leaf(t, key);
+    int eq, i = node_lower(t, &l->h, key, &eq);
+    return eq ? l->vals[i] : t_nil;
+}
+
+/* first entry with key >= key (upper == 0) or key > key (upper != 0) */
+struct tree_node *btree_bound(struct tree *t, void *key, int upper) {
+    assert(t);
+    if (!t->btree)
+        return t_nil;
+    struct btree_leaf *l = find_leaf(t, key);
+    int eq, i = node_lower(t, &l->h, key, &eq);
+    if (eq && upper)
+        i++;
+    if (i == l->h.n) {
+        l = l->next;
+        i = 0;
+    }
+    return l ? l->vals[i] : t_nil;
+}
+
+struct tree_node *btree_min(struct tree *t) {
+    struct btree_node *x = t->btree;
+    if (!x || x->n == 0)
+        return t_nil;
+    while (!x->leaf)
+        x = INNER(x)->child[0];
+    return LEAF(x)->vals[0];
+}
+
+struct tree_node *btree_max(struct tree *t) {
+    struct btree_node *x = t->btree;
+    if (!x || x->n == 0)
+        return t_nil;
+    while (!x->leaf)
+        x = INNER(x)->child[x->n];
+    return LEAF(x)->vals[x->n - 1];
+}
+
+struct tree_node *btree_successor(struct tree *t, struct tree_node *x) {
+    struct btree_leaf *l = LEAF_OF(x);
+    int i = slot_of(l, x);
+    (void)t;
+    if (i + 1 < l->h.n)
+        return l->vals[i + 1];
+    return l->next ? l->next->vals[0] : t_nil;
+}
+
+struct tree_node *btree_predecessor(struct tree *t, struct tree_node *x) {
+    struct btree_leaf *l = LEAF_OF(x);
+    int i = slot_of(l, x);
+    (void)t;
+    if (i > 0)
+        return l->vals[i - 1];
+    return l->prev ? l->prev->vals[l->prev->h.n - 1] : t_nil;
+}
+
+int btree_height(struct tree *t) {
+    struct btree_node *x = t->btree;
+    int h = 0;
+    if (!x || x->n == 0)
+        return 0;
+    for (h = 1; !x->leaf; h++)
+        x = INNER(x)->child[0];
+    return h;
+}
+
+/* in key order, along the leaf chain */
+void btree_travel(struct tree *t, void (*fn)(struct tree_node *n)) {
+    struct tree_node *x;
+    for (x = btree_min(t); x != t_nil; x = btree_successor(t, x))
+        fn(x);
+}
+
+static void split_inner(struct tree *t, struct btree_node *x);
+
+/* hang right (whose minimum is key) next to left, splitting upward as needed */
+static void insert_parent(struct tree *t, struct btree_node *left, void *key,
+                          struct btree_node *right) {
+    struct btree_node *p = left->parent;
+    int j;
+    if (!p) {
+        p = btree_alloc(0);
+        INNER(p)->child[0] = left;
+        INNER(p)->child[1] = right;
+        p->keys[0] = key;
+        p->n = 1;
+        left->parent = right->parent = p;
+        t->btree = p;
+        return;
+    }
+    if (p->n == BTREE_MAX) {
+        split_inner(t, p);
+        p = left->parent;
+    }
+    j = child_index(p, left);
+    memmove(&p->keys[j + 1], &p->keys[j], (p->n - j) * sizeof(void *));
+    memmove(&INNER(p)->child[j + 2], &INNER(p)->child[j + 1],
+            (p->n - j) * sizeof(struct btree_node *));
+    p->keys[j] = key;
+    INNER(p)->child[j + 1] = right;
+    right->parent = p;
+    p->n++;
+}
+
+static void split_inner(struct tree *t, struct btree_node *x) {
+    struct btree_node *r = btree_alloc(0);
+    int mid = x->n / 2, i;
+    void *up = x->keys[mid];
+    r->n = x->n - mid - 1;
+    memcpy(r->keys, &x->keys[mid + 1], r->n * sizeof(void *));
+    memcpy(INNER(r)->child, &INNER(x)->child[mid + 1],
+           (r->n + 1) * sizeof(struct btree_node *));
+    for (i = 0; i <= r->n; i++)
+        INNER(r)->child[i]->parent = r;
+    x->n = mid;
+    insert_parent(t, x, up, r);
+}
+
+static struct btree_leaf *split_leaf(struct tree *t, struct btree_leaf *l) {
+    struct btree_leaf *r = LEAF(btree_alloc(1));
+    int k = l->h.n / 2, i;
+    for (i = k; i < l->h.n; i++)
+        set_entry(r, i - k, l->vals[i]);
+    r->h.n = l->h.n - k;
+    l->h.n = k;
+    r->next = l->next;
+    r->prev = l;
+    if (l->next)
+        l->next->prev = r;
+    l->next = r;
+    insert_parent(t, &l->h, r->h.keys[0], &r->h);
+    return r;
+}
+
+struct tree_node *btree_insert(struct tree *t, struct tree_node *z) {
+    assert(t);
+    assert(z);
+    struct btree_leaf *l;
+    int eq, i;
+    if (!t->btree)
+        t->btree = btree_alloc(1);
+    l = find_leaf(t, z->key);
+    i = node_lower(t, &l->h, z->key, &eq);
+    if (eq)
+        return l->vals[i];
+    if (l->h.n == BTREE_MAX) {
+        struct btree_leaf *r = split_leaf(t, l);
+        if (i > l->h.n) {
+            i -= l->h.n;
+            l = r;
+        }
+    }
+    memmove(&l->h.keys[i + 1], &l->h.keys[i], (l->h.n - i) * sizeof(void *));
+    memmove(&l->vals[i + 1], &l->vals[i], (l->h.n - i) * sizeof(struct tree_node *));
+    set_entry(l, i, z);
+    l->h.n++;
+    z->left = z->right = t_nil;
+    return z;
+}
+
+static void rebalance_inner(struct tree *t, struct btree_node *x);
+
+/* drop keys[k] and child[k + 1] from inner node p */
+static void remove_from_inner(struct tree *t, struct btree_node *p, int k) {
+    memmove(&p->keys[k], &p->keys[k + 1], (p->n - k - 1) * sizeof(void *));
+    memmove(&INNER(p)->child[k + 1], &INNER(p)->child[k + 2],
+            (p->n - k - 1) * sizeof(struct btree_node *));
+    p->n--;
+    rebalance_inner(t, p);
+}
+
+static void rebalance_inner(struct tree *t, struct btree_node *x) {
+    struct btree_node *p = x->parent, *left, *right;
+    int j, i;
+    if (!p) {
+        if (x->n == 0) {
+            t->btree = INNER(x)->child[0];
+            t->btree->parent = NULL;
+            free(x);
+        }
+        return;
+    }
+    if (x->n >= BTREE_INNER_MIN)
+        return;
+    j = child_index(p, x);
+    left = j > 0 ? INNER(p)->child[j - 1] : NULL;
+    right = j < p->n ? INNER(p)->child[j + 1] : NULL;
+    if (left && left->n > BTREE_INNER_MIN) {
+        memmove(&x->keys[1], &x->keys[0], x->n * sizeof(void *));
+        memmove(&INNER(x)->child[1], &INNER(x)->child[0],
+                (x->n + 1) * sizeof(struct btree_node *));
+        x->keys[0] = p->keys[j - 1];
+        INNER(x)->child[0] = INNER(left)->child[left->n];
+        INNER(x)->child[0]->parent = x;
+        p->keys[j - 1] = left->keys[left->n - 1];
+        left->n--;
+        x->n++;
+    } else if (right && right->n > BTREE_INNER_MIN) {
+        x->keys[x->n] = p->keys[j];
+        INNER(x)->child[x->n + 1] = INNER(right)->child[0];
+        INNER(x)->child[x->n + 1]->parent = x;
+        x->n++;
+        p->keys[j] = right->keys[0];
+        memmove(&right->keys[0], &right->keys[1], (right->n - 1) * sizeof(void *));
+        memmove(&INNER(right)->child[0], &INNER(right)->child[1],
+                right->n * sizeof(struct btree_node *));
+        right->n--;
+    } else {
+        struct btree_node *l = left ? left : x, *r = left ? x : right;
+        int k = left ? j - 1 : j;
+        l->keys[l->n] = p->keys[k];
+        memcpy(&l->keys[l->n + 1], r->keys, r->n * sizeof(void *));
+        memcpy(&INNER(l)->child[l->n + 1], INNER(r)->child,
+               (r->n + 1) * sizeof(struct btree_node *));
+        for (i = 0; i <= r->n; i++)
+            INNER(r)->child[i]->parent = l;
+        l->n += r->n + 1;
+        free(r);
+        remove_from_inner(t, p, k);
+    }
+}
+
+static void rebalance_leaf(struct tree *t, struct btree_leaf *x) {
+    struct btree_node *p = x->h.parent;
+    struct btree_leaf *left, *right;
+    int j, i;
+    if (!p) {
+        if (x->h.n == 0) {
+            free(x);
+            t->btree = NULL;
+        }
+        return;
+    }
+    if (x->h.n >= BTREE_LEAF_MIN)
+        return;
+    j = child_index(p, &x->h);
+    left = j > 0 ? LEAF(INNER(p)->child[j - 1]) : NULL;
+    right = j < p->n ? LEAF(INNER(p)->child[j + 1]) : NULL;
+    if (left && left->h.n > BTREE_LEAF_MIN) {
+        memmove(&x->h.keys[1], &x->h.keys[0], x->h.n * sizeof(void *));
+        memmove(&x->vals[1], &x->vals[0], x->h.n * sizeof(struct tree_node *));
+        set_entry(x, 0, left->vals[--left->h.n]);
+        x->h.n++;
+        p->keys[j - 1] = x->h.keys[0];
+    } else if (right && right->h.n > BTREE_LEAF_MIN) {
+        set_entry(x, x->h.n++, right->vals[0]);
+        right->h.n--;
+        memmove(&right->h.keys[0], &right->h.keys[1], right->h.n * sizeof(void *));
+        memmove(&right->vals[0], &right->vals[1], right->h.n * sizeof(struct tree_node *));
+        p->keys[j] = right->h.keys[0];
+    } else {
+        struct btree_leaf *l = left ? left : x, *r = left ? x : right;
+        for (i = 0; i < r->h.n; i++)
+            set_entry(l, l->h.n + i, r->vals[i]);
+        l->h.n += r->h.n;
+        l->next = r->next;
+        if (r->next)
+            r->next->prev = l;
+        free(r);
+        remove_from_inner(t, p, left ? j - 1 : j);
+    }
+}
+
+/* l now starts with a new minimum: refresh the separator in front of it */
+static void fix_min(struct btree_leaf *l) {
+    struct btree_node *x = &l->h;
+    while (x->parent) {
+        int j = child_index(x->parent, x);
+        if (j > 0) {
+            x->parent->keys[j - 1] = l->h.keys[0];
+            return;
+        }
+        x = x->parent;
+    }
+}
+
+void btree_delete(struct tree *t, struct tree_node *z) {
+    assert(t);
+    assert(z);
+    struct btree_leaf *l = LEAF_OF(z);
+    struct tree_node *s = NULL;
+    int i = slot_of(l, z);
+    if (i == 0) {
+        /* the separator in front of l may point at z->key; once the leaves
+           have settled it is re-pointed at the successor's key */
+        if (l->h.n > 1)
+            s = l->vals[1];
+        else if (l->next)
+            s = l->next->vals[0];
+    }
+    l->h.n--;
+    memmove(&l->h.keys[i], &l->h.keys[i + 1], (l->h.n - i) * sizeof(void *));
+    memmove(&l->vals[i], &l->vals[i + 1], (l->h.n - i) * sizeof(struct tree_node *));
+    z->p = z->left = z->right = t_nil;
+    rebalance_leaf(t, l);
+    if (s && LEAF_OF(s)->vals[0] == s)
+        fix_min(LEAF_OF(s));
+}
+
+/*
+ * Bottom-up in O(n): the entries are dealt into as few leaves as hold them,
+ * spread evenly so each is close to full and none is under the minimum,
+ * then each inner level is built the same way over the level below, with
+ * every child's minimum key as its separator.
+ */
+void btree_build_sorted(struct tree *t, struct tree_node **nodes, size_t n) {
+    struct built {
+        struct btree_node *x;
+        void *min;
+    } *level;
+    struct btree_leaf *prev = NULL;
+    size_t count, per, extra, i, j, k;
+    assert(t);
+    assert(!t->btree);
+    if (n == 0)
+        return;
+    count = (n + BTREE_MAX - 1) / BTREE_MAX;
+    level = malloc(count * sizeof(*level));
+    assert(level);
+    per = n / count;
+    extra = n % count;
+    for (i = k = 0; i < count; i++) {
+        struct btree_leaf *l = LEAF(btree_alloc(1));
+        l->h.n = per + (i < extra);
+        for (j = 0; j < (size_t)l->h.n; j++, k++) {
+            set_entry(l, j, nodes[k]);
+            nodes[k]->left = nodes[k]->right = t_nil;
+        }
+        l->prev = prev;
+        if (prev)
+            prev->next = l;
+        prev = l;
+        level[i].x = &l->h;
+        level[i].min = l->h.keys[0];
+    }
+    /* parent i is written over level[i] once its children, which sit at
+       k >= i, have been read */
+    while (count > 1) {
+        size_t parents = (count + BTREE_MAX) / (BTREE_MAX + 1);
+        per = count / parents;
+        extra = count % parents;
+        for (i = k = 0; i < parents; i++) {
+            struct btree_node *p = btree_alloc(0);
+            size_t m = per + (i < extra);
+            void *min = level[k].min;
+            for (j = 0; j < m; j++, k++) {
+                INNER(p)->child[j] = level[k].x;
+                level[k].x->parent = p;
+                if (j > 0)
+                    p->keys[j - 1] = level[k].min;
+            }
+            p->n = m - 1;
+            level[i].x = p;
+            level[i].min = min;
+        }
+        count = parents;
+    }
+    t->btree = level[0].x;
+    free(level);
+}
+
+/* free the index; the entries themselves belong to the caller */
+void btree_destroy(struct tree *t) {
+    struct btree_node *x = t->btree;
+    while (x) {
+        if (!x->leaf && x->n >= 0) {
+            struct btree_node *c = INNER(x)->child[x->n];
+            x->n--;
+            x = c;
+        } else {
+            struct btree_node *p = x->parent;
+            free(x);
+            x = p;
+        }
+    }
+    t->btree = NULL;
+}
@@ -0,0 +1,376 @@
+#include "ctree.h"
+
+#include <stdlib.h>
+
+#define CT_FLAG 0x80000000u
+#define CT_MAX (CT_FLAG - 1)
+
+static struct ctree_node *node(struct ctree *ct, uint32_t x) {
+    return &ct->nodes[x];
+}
+
+static uint32_t child(struct ctree *ct, uint32_t x, int d) {
+    return ct->nodes[x].link[d] & ~CT_FLAG;
+}
+
+/* store an index in a link, keeping the link's flag */
+static void set_link(uint32_t *link, uint32_t x) {
+    *link = (*link & CT_FLAG) | x;
+}
+
+static int flag(struct ctree *ct, uint32_t x, int d) {
+    return (ct->nodes[x].link[d] & CT_FLAG) != 0;
+}
+
+static void set_flag(struct ctree *ct, uint32_t x, int d, int on) {
+    if (on)
+        ct->nodes[x].link[d] |= CT_FLAG;
+    else
+        ct->nodes[x].link[d] &= ~CT_FLAG;
+}
+
+/* T_RB: the colour bit; nil is black */
+static int red(struct ctree *ct, uint32_t x) {
+    return x && flag(ct, x, 0);
+}
+
+/* T_AVL: side d is taller; both clear when balanced */
+static void set_balance(struct ctree *ct, uint32_t x, int taller) {
+    set_flag(ct, x, 0, taller == 0);
+    set_flag(ct, x, 1, taller == 1);
+}
+
+#define BALANCED (-1)
+
+/*
+ * Rotate the subtree in *slot so its child on side !d comes up and the old
+ * root goes down on side d: d = 0 is a left rotation.
+ */
+static void rotate(struct ctree *ct, uint32_t *slot, int d) {
+    uint32_t x = *slot & ~CT_FLAG, y = child(ct, x, !d);
+    set_link(&node(ct, x)->link[!d], child(ct, y, d));
+    set_link(&node(ct, y)->link[d], x);
+    set_link(slot, y);
+}
+
+/* the link holding path[i]: the root, or a child link of path[i - 1] */
+static uint32_t *slot_of(struct ctree *ct, uint32_t *path, int *dir, int i) {
+    if (i == 0)
+        return &ct->root;
+    return &node(ct, path[i - 1])->link[dir[i - 1]];
+}
+
+void ctree_init(struct ctree *ct, const struct tree *t) {
+    assert(ct);
+    assert(t);
+    assert(t->type == T_RB || t->type == T_AVL);
+    ct->keys = *t;
+    ct->nodes = NULL;
+    ct->root = 0;
+    ct->free = 0;
+    ct->used = 1;
+    ct->cap = 0;
+    ct->count = 0;
+}
+
+void ctree_destroy(struct ctree *ct) {
+    free(ct->nodes);
+    ct->nodes = NULL;
+    ct->root = ct->free = ct->cap = 0;
+    ct->used = 1;
+    ct->count = 0;
+}
+
+static void grow(struct ctree *ct, size_t cap) {
+    struct ctree_node *nodes;
+    assert(cap <= (size_t)CT_MAX + 1);
+    nodes = realloc(ct->nodes, cap * sizeof(*nodes));
+    assert(nodes);
+    ct->nodes = nodes;
+    ct->cap = cap;
+}
+
+void ctree_reserve(struct ctree *ct, size_t n) {
+    if (n + 1 > ct->cap)
+        grow(ct, n + 1);
+}
+
+size_t ctree_bytes(struct ctree *ct) {
+    return ct->cap * sizeof(struct ctree_node);
+}
+
+static uint32_t node_alloc(struct ctree *ct) {
+    uint32_t x = ct->free;
+    if (x) {
+        ct->free = node(ct, x)->link[0];
+        return x;
+    }
+    if (ct->used >= ct->cap) {
+        size_t cap = ct->cap ? (size_t)ct->cap * 2 : 64;
+        grow(ct, cap > (size_t)CT_MAX + 1 ? (size_t)CT_MAX + 1 : cap);
+    }
+    assert(ct->used <= CT_MAX);
+    return ct->used++;
+}
+
+static void node_free(struct ctree *ct, uint32_t x) {
+    node(ct, x)->link[0] = ct->free;
+    ct->free = x;
+}
+
+struct ctree_node *ctree_search(struct ctree *ct, void *key) {
+    uint32_t x = ct->root;
+    while (x) {
+        int c = tree_key_cmp(&ct->keys, key, node(ct, x)->key);
+        if (c == 0)
+            return node(ct, x);
+        x = child(ct, x, c > 0);
+    }
+    return NULL;
+}
+
+/* rb_insert_fixup on the path, path[i] being the new red node */
+static void rb_insert_fix(struct ctree *ct, uint32_t *path, int *dir, int i) {
+    while (i >= 2 && red(ct, path[i - 1])) {
+        uint32_t z = path[i], p = path[i - 1], g = path[i - 2];
+        int d = dir[i - 2];
+        uint32_t u = child(ct, g, !d);
+        if (red(ct, u)) {
+            set_flag(ct, p, 0, 0);
+            set_flag(ct, u, 0, 0);
+            set_flag(ct, g, 0, 1);
+            i -= 2;
+            continue;
+        }
+        if (z == child(ct, p, !d)) {
+            rotate(ct, &node(ct, g)->link[d], d);
+            p = z;
+        }
+        set_flag(ct, p, 0, 0);
+        set_flag(ct, g, 0, 1);
+        rotate(ct, slot_of(ct, path, dir, i - 2), !d);
+        break;
+    }
+    set_flag(ct, ct->root, 0, 0);
+}
+
+/* the subtree on side dir[i] of path[i] grew one level, for i from i down */
+static void avl_insert_fix(struct ctree *ct, uint32_t *path, int *dir, int i) {
+    for (; i >= 0; i--) {
+        uint32_t p = path[i], c, g;
+        int d = dir[i];
+        if (flag(ct, p, !d)) {
+            set_balance(ct, p, BALANCED);
+            return;
+        }
+        if (!flag(ct, p, d)) {
+            set_balance(ct, p, d);
+            continue;
+        }
+        /* two taller on side d now */
+        c = child(ct, p, d);
+        if (flag(ct, c, d)) {
+            rotate(ct, slot_of(ct, path, dir, i), !d);
+            set_balance(ct, p, BALANCED);
+            set_balance(ct, c, BALANCED);
+            return;
+        }
+        g = child(ct, c, !d);
+        set_balance(ct, p, flag(ct, g, d) ? !d : BALANCED);
+        set_balance(ct, c, flag(ct, g, !d) ? d : BALANCED);
+        set_balance(ct, g, BALANCED);
+        rotate(ct, &node(ct, p)->link[d], d);
+        rotate(ct, slot_of(ct, path, dir, i), !d);
+        return;
+    }
+}
+
+struct ctree_node *ctree_insert(struct ctree *ct, void *key, void *data) {
+    uint32_t path[CTREE_MAX_DEPTH], x = ct->root, z;
+    int dir[CTREE_MAX_DEPTH], n = 0;
+    assert(ct);
+    while (x) {
+        int c = tree_key_cmp(&ct->keys, key, node(ct, x)->key);
+        if (c == 0)
+            return node(ct, x);
+        assert(n < CTREE_MAX_DEPTH - 1);
+        path[n] = x;
+        dir[n++] = c > 0;
+        x = child(ct, x, c > 0);
+    }
+    /* may move the array, so before any link is held by address */
+    z = node_alloc(ct);
+    node(ct, z)->link[0] = node(ct, z)->link[1] = 0;
+    node(ct, z)->key = key;
+    node(ct, z)->data = data;
+    if (n == 0)
+        ct->root = z;
+    else
+        set_link(&node(ct, path[n - 1])->link[dir[n - 1]], z);
+    ct->count++;
+    if (ct->keys.type == T_RB) {
+        set_flag(ct, z, 0, 1);
+        path[n] = z;
+        rb_insert_fix(ct, path, dir, n);
+    } else {
+        avl_insert_fix(ct, path, dir, n - 1);
+    }
+    return node(ct, z);
+}
+
+/*
+ * rb_tree_delete_fixup: a black node was removed from side d of path[i]
+ * (the root if i < 0), leaving that side one black short.
+ */
+static void rb_delete_fix(struct ctree *ct, uint32_t *path, int *dir, int i, int d) {
+    uint32_t x;
+    while (i >= 0 && !red(ct, x = child(ct, path[i], d))) {
+        uint32_t xp = path[i], w = child(ct, xp, !d);
+        if (red(ct, w)) {
+            set_flag(ct, w, 0, 0);
+            set_flag(ct, xp, 0, 1);
+            rotate(ct, slot_of(ct, path, dir, i), d);
+            /* w is xp's parent now */
+            path[i + 1] = xp;
+            dir[i + 1] = d;
+            path[i] = w;
+            dir[i] = d;
+            i++;
+            w = child(ct, xp, !d);
+        }
+        if (!red(ct, child(ct, w, 0)) && !red(ct, child(ct, w, 1))) {
+            set_flag(ct, w, 0, 1);
+            if (--i >= 0)
+                d = dir[i];
+            continue;
+        }
+        if (!red(ct, child(ct, w, !d))) {
+            set_flag(ct, child(ct, w, d), 0, 0);
+            set_flag(ct, w, 0, 1);
+            rotate(ct, &node(ct, xp)->link[!d], !d);
+            w = child(ct, xp, !d);
+        }
+        set_flag(ct, w, 0, red(ct, xp));
+        set_flag(ct, xp, 0, 0);
+        set_flag(ct, child(ct, w, !d), 0, 0);
+        rotate(ct, slot_of(ct, path, dir, i), d);
+        return;
+    }
+    x = i < 0 ? ct->root : child(ct, path[i], d);
+    if (x)
+        set_flag(ct, x, 0, 0);
+}
+
+/* the subtree on side dir[i] of path[i] shrank one level, for i from i down */
+static void avl_delete_fix(struct ctree *ct, uint32_t *path, int *dir, int i) {
+    for (; i >= 0; i--) {
+        uint32_t p = path[i], s, g;
+        int d = dir[i];
+        if (flag(ct, p, d)) {
+            set_balance(ct, p, BALANCED);
+            continue;
+        }
+        if (!flag(ct, p, !d)) {
+            set_balance(ct, p, !d);
+            return;
+        }
+        /* two taller on side !d now */
+        s = child(ct, p, !d);
+        if (!flag(ct, s, d)) {
+            int even = !flag(ct, s, !d);
+            rotate(ct, slot_of(ct, path, dir, i), d);
+            set_balance(ct, p, even ? !d : BALANCED);
+            set_balance(ct, s, even ? d : BALANCED);
+            /* an evenly balanced sibling keeps the height */
+            if (even)
+                return;
+            continue;
+        }
+        g = child(ct, s, d);
+        set_balance(ct, p, flag(ct, g, !d) ? d : BALANCED);
+        set_balance(ct, s, flag(ct, g, d) ? !d : BALANCED);
+        set_balance(ct, g, BALANCED);
+        rotate(ct, &node(ct, p)->link[!d], !d);
+        rotate(ct, slot_of(ct, path, dir, i), d);
+    }
+}
+
+int ctree_delete(struct ctree *ct, void *key, void **data) {
+    uint32_t path[CTREE_MAX_DEPTH], z = ct->root, y, c;
+    int dir[CTREE_MAX_DEPTH], n = 0, removed_red;
+    assert(ct);
+    for (;;) {
+        int r;
+        if (!z)
+            return 0;
+        r = tree_key_cmp(&ct->keys, key, node(ct, z)->key);
+        if (r == 0)
+            break;
+        assert(n < CTREE_MAX_DEPTH - 1);
+        path[n] = z;
+        dir[n++] = r > 0;
+        z = child(ct, z, r > 0);
+    }
+    if (data)
+        *data = node(ct, z)->data;
+    if (child(ct, z, 0) && child(ct, z, 1)) {
+        /* take over the successor's entry and unlink that node instead */
+        path[n] = z;
+        dir[n++] = 1;
+        for (y = child(ct, z, 1); child(ct, y, 0); y = child(ct, y, 0)) {
+            path[n] = y;
+            dir[n++] = 0;
+        }
+        node(ct, z)->key = node(ct, y)->key;
+        node(ct, z)->data = node(ct, y)->data;
+        z = y;
+    }
+    c = child(ct, z, 0) ? child(ct, z, 0) : child(ct, z, 1);
+    if (n == 0)
+        ct->root = c;
+    else
+        set_link(&node(ct, path[n - 1])->link[dir[n - 1]], c);
+    removed_red = red(ct, z);
+    node_free(ct, z);
+    ct->count--;
+    if (ct->keys.type == T_RB) {
+        if (!removed_red)
+            rb_delete_fix(ct, path, dir, n - 1, n ? dir[n - 1] : 0);
+    } else {
+        avl_delete_fix(ct, path, dir, n - 1);
+    }
+    return 1;
+}
+
+void ctree_iter_init(struct ctree_iter *it, struct ctree *ct) {
+    uint32_t x;
+    it->ct = ct;
+    it->n = 0;
+    for (x = ct->root; x; x = child(ct, x, 0))
+        it->stack[it->n++] = x;
+}
+
+void ctree_iter_seek(struct ctree_iter *it, struct ctree *ct, void *key) {
+    uint32_t x = ct->root;
+    it->ct = ct;
+    it->n = 0;
+    while (x) {
+        if (tree_key_cmp(&ct->keys, key, node(ct, x)->key) <= 0) {
+            it->stack[it->n++] = x;
+            x = child(ct, x, 0);
+        } else {
+            x = child(ct, x, 1);
+        }
+    }
+}
+
+struct ctree_node *ctree_iter_next(struct ctree_iter *it) {
+    struct ctree *ct = it->ct;
+    uint32_t x, y;
+    if (it->n == 0)
+        return NULL;
+    x = it->stack[--it->n];
+    for (y = child(ct, x, 1); y; y = child(ct, y, 0))
+        it->stack[it->n++] = y;
+    return node(ct, x);
+}
@@ -0,0 +1,75 @@
+#ifndef CTREE_H
+#define CTREE_H
+
+#include <stdint.h>
+
+#include "trees.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compact red-black or AVL tree of 24-byte entries, well under a struct
+ * tree_node (benchmark compact prints both sizes). Nodes live in one array
+ * and link to each other with 32-bit indices; there is no parent link, so
+ * insert and delete keep the search path on a stack. The top bit of each
+ * link is free for balance information: the node's colour in link[0] for
+ * T_RB, and for T_AVL a bit per side that is set while that side is the
+ * taller one.
+ *
+ * Index 0 is the nil link. A ctree holds at most 2^31 - 1 entries.
+ * Insert may move the array, so node pointers stay valid only until the
+ * next insert; a delete may also move the successor's entry into the
+ * node that held the deleted key.
+ */
+struct ctree_node {
+    uint32_t link[2];
+    void *key;
+    void *data;
+};
+
+struct ctree {
+    struct tree keys;   /* compare settings and type */
+    struct ctree_node *nodes;
+    uint32_t root;
+    uint32_t free;      /* freed slots, chained through link[0] */
+    uint32_t used;      /* slots handed out so far, counting index 0 */
+    uint32_t cap;
+    size_t count;
+};
+
+/* a red-black tree over 2^31 entries is at most 62 deep */
+#define CTREE_MAX_DEPTH 64
+
+struct ctree_iter {
+    struct ctree *ct;
+    uint32_t stack[CTREE_MAX_DEPTH];
+    int n;
+};
+
+/* compare like t; t->type is T_RB or T_AVL */
+void ctree_init(struct ctree *ct, const struct tree *t);
+void ctree_destroy(struct ctree *ct);
+/* make room for n entries in all, so the next inserts do not grow */
+void ctree_reserve(struct ctree *ct, size_t n);
+/* memory held by the node array */
+size_t ctree_bytes(struct ctree *ct);
+
+struct ctree_node *ctree_search(struct ctree *ct, void *key);
+/* returns the node holding key: the new one, or the one already there */
+struct ctree_node *ctree_insert(struct ctree *ct, void *key, void *data);
+/* returns 1 if key was removed; *data (if not NULL) gets its data */
+int ctree_delete(struct ctree *ct, void *key, void **data);
+
+/* in-order scan from the smallest key, or from the first key >= key; the
+   tree must not change during a scan */
+void ctree_iter_init(struct ctree_iter *it, struct ctree *ct);
+void ctree_iter_seek(struct ctree_iter *it, struct ctree *ct, void *key);
+struct ctree_node *ctree_iter_next(struct ctree_iter *it);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,65 @@
+#include "hdr_hist.h"
+
+#include <string.h>
+
+void hdr_init(struct hdr_hist *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+void hdr_merge(struct hdr_hist *dst, const struct hdr_hist *src) {
+    int i;
+    for (i = 0; i < HDR_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/* the first value of bucket i and its width */
+static uint64_t bucket_low(int i, uint64_t *width) {
+    int shift;
+    if (i < HDR_SUB) {
+        *width = 1;
+        return (uint64_t)i;
+    }
+    shift = i / HDR_SUB - 1;
+    *width = (uint64_t)1 << shift;
+    return (uint64_t)(i % HDR_SUB + HDR_SUB) << shift;
+}
+
+uint64_t hdr_percentile(const struct hdr_hist *h, double p) {
+    uint64_t want, seen = 0, low, width;
+    double rank = p / 100 * h->count;
+    int i;
+    if (h->count == 0)
+        return 0;
+    if (p >= 100)
+        return h->max;
+    /* nearest rank: the ceil(rank)-th smallest, counting from 1 */
+    want = (uint64_t)rank;
+    if (want < rank || want == 0)
+        want++;
+    for (i = 0; i < HDR_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= want)
+            break;
+    }
+    low = bucket_low(i, &width);
+    return low + width - 1 < h->max ? low + width - 1 : h->max;
+}
+
+/* by bucket midpoints */
+double hdr_mean(const struct hdr_hist *h) {
+    double sum = 0;
+    uint64_t low, width;
+    int i;
+    if (h->count == 0)
+        return 0;
+    for (i = 0; i < HDR_BUCKETS; i++) {
+        if (!h->buckets[i])
+            continue;
+        low = bucket_low(i, &width);
+        sum += (low + (width - 1) / 2.0) * h->buckets[i];
+    }
+    return sum / h->count;
+}
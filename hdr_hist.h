@@ -0,0 +1,54 @@
+#ifndef HDR_HIST_H
+#define HDR_HIST_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Log-linear latency histogram in the style of HdrHistogram: values below
+ * 2^HDR_SUB_BITS get a bucket each, and every power of two above that is
+ * split into 2^HDR_SUB_BITS equal buckets, so a value is kept to within
+ * 1/32 of itself. Recording is a shift and an increment into a fixed
+ * array; nothing is allocated and any 64-bit value fits.
+ */
+#define HDR_SUB_BITS 5
+#define HDR_SUB (1 << HDR_SUB_BITS)
+#define HDR_BUCKETS ((64 - HDR_SUB_BITS + 1) * HDR_SUB)
+
+struct hdr_hist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HDR_BUCKETS];
+};
+
+static inline int hdr_bucket(uint64_t v) {
+    int shift;
+    if (v < HDR_SUB)
+        return (int)v;
+    shift = 63 - __builtin_clzll(v) - HDR_SUB_BITS;
+    return (shift + 1) * HDR_SUB + (int)(v >> shift) - HDR_SUB;
+}
+
+static inline void hdr_record(struct hdr_hist *h, uint64_t v) {
+    h->buckets[hdr_bucket(v)]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+void hdr_init(struct hdr_hist *h);
+/* add src's values to dst */
+void hdr_merge(struct hdr_hist *dst, const struct hdr_hist *src);
+/* smallest recorded value at or above p percent of the values, rounded up
+   to its bucket's top (but not past max); 0 if empty */
+uint64_t hdr_percentile(const struct hdr_hist *h, double p);
+double hdr_mean(const struct hdr_hist *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
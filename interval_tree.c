@@ -0,0 +1,82 @@
+#include "interval_tree.h"
+
+#include <stdint.h>
+
+/* by low end, then high end, then address so equal intervals can coexist */
+static int interval_cmp(void *k1, void *k2) {
+    struct interval *a = k1, *b = k2;
+    if (a->lo != b->lo)
+        return a->lo < b->lo ? -1 : 1;
+    if (a->hi != b->hi)
+        return a->hi < b->hi ? -1 : 1;
+    if (a != b)
+        return (uintptr_t)a < (uintptr_t)b ? -1 : 1;
+    return 0;
+}
+
+static int interval_less(void *k1, void *k2) {
+    return interval_cmp(k1, k2) < 0;
+}
+
+static long interval_hi(struct tree_node *x) {
+    return ((struct interval *)x->key)->hi;
+}
+
+static long max_hi(long a, long b) {
+    return a > b ? a : b;
+}
+
+void itree_init(struct tree *t) {
+    struct tree empty = T_INITIAL;
+    assert(t);
+    *t = empty;
+    t->type = T_RB;
+    t->key_less = interval_less;
+    t->key_cmp = interval_cmp;
+    t->agg_value = interval_hi;
+    t->agg_combine = max_hi;
+}
+
+void itree_insert(struct tree *t, struct interval *iv) {
+    struct tree_node *x;
+    assert(iv->lo <= iv->hi);
+    iv->node.node.p = iv->node.node.left = iv->node.node.right = t_nil;
+    iv->node.node.key = iv;
+    x = rb_tree_insert(t, &iv->node.node);
+    assert(x == &iv->node.node);
+    (void)x;
+}
+
+void itree_delete(struct tree *t, struct interval *iv) {
+    rb_tree_delete(t, &iv->node.node);
+}
+
+/* in order; recursion is bounded by the red-black height */
+static int overlap(struct tree_node *x, long lo, long hi,
+                   int (*fn)(struct interval *iv, void *ctx), void *ctx) {
+    while (x != t_nil && tree_aug(x)->agg >= lo) {
+        struct interval *iv = x->key;
+        int r = overlap(x->left, lo, hi, fn, ctx);
+        if (r)
+            return r;
+        /* everything from here on starts after hi */
+        if (iv->lo > hi)
+            return 0;
+        if (iv->hi >= lo && (r = fn(iv, ctx)))
+            return r;
+        x = x->right;
+    }
+    return 0;
+}
+
+int itree_overlap(struct tree *t, long lo, long hi,
+                  int (*fn)(struct interval *iv, void *ctx), void *ctx) {
+    assert(t);
+    assert(t->agg_combine == max_hi);
+    return overlap(t->root, lo, hi, fn, ctx);
+}
+
+int itree_stab(struct tree *t, long x,
+               int (*fn)(struct interval *iv, void *ctx), void *ctx) {
+    return itree_overlap(t, x, x, fn, ctx);
+}
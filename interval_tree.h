@@ -0,0 +1,44 @@
+#ifndef INTERVAL_TREE_H
+#define INTERVAL_TREE_H
+
+#include "trees.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Interval tree on the red-black tree: intervals are ordered by low end
+ * and every node's agg is the largest high end in its subtree, kept by
+ * the augmentation hook through rotations and fixups. A query skips every
+ * subtree whose largest high end is below it and stops at the first low
+ * end above it, so it only enters subtrees that hold a hit: it visits the
+ * union of the root-to-hit paths, O(k log(n/k)) nodes for k hits, and
+ * O(log n) when there are none.
+ *
+ * Intervals are closed, [lo, hi]. Equal intervals may be stored more than
+ * once. node.data is left to the caller.
+ */
+struct interval {
+    struct tree_node_aug node;
+    long lo, hi;
+};
+
+/* t becomes an empty T_RB interval tree */
+void itree_init(struct tree *t);
+/* iv->lo <= iv->hi must be set; iv->node is overwritten */
+void itree_insert(struct tree *t, struct interval *iv);
+void itree_delete(struct tree *t, struct interval *iv);
+/* call fn on each interval overlapping [lo, hi], by low end, until it
+   returns nonzero; returns that value, or 0. O(k log(n/k)) for k hits */
+int itree_overlap(struct tree *t, long lo, long hi,
+                  int (*fn)(struct interval *iv, void *ctx), void *ctx);
+/* ... each interval containing x */
+int itree_stab(struct tree *t, long x,
+               int (*fn)(struct interval *iv, void *ctx), void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
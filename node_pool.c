@@ -0,0 +1,58 @@
+#include "node_pool.h"
+
+#include <stdlib.h>
+
+/* every slab starts with this header; nodes follow, suitably aligned */
+struct slab {
+    struct slab *next;
+    max_align_t pad[];
+};
+
+static size_t pool_align(size_t n) {
+    size_t a = _Alignof(max_align_t);
+    return (n + a - 1) / a * a;
+}
+
+void node_pool_init(struct node_pool *p, size_t node_size, size_t slab_nodes) {
+    assert(p);
+    assert(node_size >= sizeof(void *));
+    assert(slab_nodes > 0);
+    p->node_size = pool_align(node_size);
+    p->slab_nodes = slab_nodes;
+    p->slabs = NULL;
+    p->free_list = NULL;
+    p->next = p->end = NULL;
+}
+
+/* start a new slab and hand out its first node */
+void *node_pool_grow(struct node_pool *p) {
+    struct slab *s = malloc(sizeof(struct slab) + p->node_size * p->slab_nodes);
+    if (!s)
+        return NULL;
+    s->next = p->slabs;
+    p->slabs = s;
+    p->next = (char *)s->pad + p->node_size;
+    p->end = (char *)s->pad + p->node_size * p->slab_nodes;
+    return s->pad;
+}
+
+void node_pool_destroy(struct node_pool *p) {
+    assert(p);
+    struct slab *s = p->slabs;
+    while (s) {
+        struct slab *next = s->next;
+        free(s);
+        s = next;
+    }
+    p->slabs = NULL;
+    p->free_list = NULL;
+    p->next = p->end = NULL;
+}
+
+void node_pool_destroy_tree(struct node_pool *p, struct tree *t) {
+    assert(t);
+    if (t->type == T_BTREE)
+        btree_destroy(t);
+    t->root = t_nil;
+    node_pool_destroy(p);
+}
@@ -0,0 +1,60 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <stddef.h>
+
+#include "trees.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fixed-size node allocator: nodes are carved out of large slabs and freed
+ * nodes go on a free list, so allocation is a pointer bump or a pop and a
+ * whole tree can be thrown away by releasing its slabs, without visiting a
+ * single node. node_size may be larger than struct tree_node so callers can
+ * embed the node at the start of their own record (key storage etc.).
+ */
+struct node_pool {
+    size_t node_size;
+    size_t slab_nodes;
+    void *slabs;
+    void *free_list;
+    char *next, *end;
+};
+
+/* node_size is rounded up once here, so every node stays aligned */
+void node_pool_init(struct node_pool *p, size_t node_size, size_t slab_nodes);
+/* NULL if the slab cannot be allocated; p is left as it was */
+void *node_pool_grow(struct node_pool *p);
+/* free every slab; all nodes handed out by p become invalid */
+void node_pool_destroy(struct node_pool *p);
+/* empty t and destroy p with it in one go, without visiting the nodes. p
+   must serve t alone: nodes of any other tree sharing p are freed too */
+void node_pool_destroy_tree(struct node_pool *p, struct tree *t);
+
+/* a node of node_size bytes, or NULL if out of memory */
+static inline void *node_pool_alloc(struct node_pool *p) {
+    void *n = p->free_list;
+    if (n) {
+        p->free_list = *(void **)n;
+        return n;
+    }
+    if (p->next == p->end)
+        return node_pool_grow(p);
+    n = p->next;
+    p->next += p->node_size;
+    return n;
+}
+
+static inline void node_pool_free(struct node_pool *p, void *n) {
+    *(void **)n = p->free_list;
+    p->free_list = n;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,71 @@
+#include "perf_counters.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+const char *const perf_event_names[PERF_EVENTS] = {
+    "cycles", "cache_misses", "branch_misses"
+};
+
+static const uint64_t configs[PERF_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+int perf_counters_open(struct perf_counters *pc) {
+    struct perf_event_attr attr;
+    int i, opened = 0, err = 0;
+    for (i = 0; i < PERF_EVENTS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        pc->value[i] = PERF_NA;
+        if (pc->fd[i] >= 0)
+            opened++;
+        else
+            err = errno;
+    }
+    if (!opened) {
+        errno = err;
+        return -1;
+    }
+    return opened;
+}
+
+void perf_counters_close(struct perf_counters *pc) {
+    int i;
+    for (i = 0; i < PERF_EVENTS; i++) {
+        if (pc->fd[i] >= 0)
+            close(pc->fd[i]);
+        pc->fd[i] = -1;
+    }
+}
+
+void perf_counters_start(struct perf_counters *pc) {
+    int i;
+    for (i = 0; i < PERF_EVENTS; i++) {
+        if (pc->fd[i] < 0)
+            continue;
+        ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perf_counters_stop(struct perf_counters *pc) {
+    int i;
+    for (i = 0; i < PERF_EVENTS; i++) {
+        uint64_t v;
+        if (pc->fd[i] < 0)
+            continue;
+        ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        pc->value[i] = read(pc->fd[i], &v, sizeof(v)) == sizeof(v) ? v : PERF_NA;
+    }
+}
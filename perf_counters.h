@@ -0,0 +1,41 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Hardware counters for the calling thread through perf_event_open(2),
+ * user space only. Each event is opened on its own, so a machine that
+ * lacks one (common under virtualisation) still reports the others;
+ * an event that could not be opened reads as PERF_NA.
+ */
+enum perf_event_id {
+    PERF_CYCLES, PERF_CACHE_MISSES, PERF_BRANCH_MISSES, PERF_EVENTS
+};
+
+#define PERF_NA UINT64_MAX
+
+struct perf_counters {
+    int fd[PERF_EVENTS];
+    uint64_t value[PERF_EVENTS];
+};
+
+extern const char *const perf_event_names[PERF_EVENTS];
+
+/* returns the number of events opened; -1 with errno set if none were */
+int perf_counters_open(struct perf_counters *pc);
+void perf_counters_close(struct perf_counters *pc);
+/* zero and start counting */
+void perf_counters_start(struct perf_counters *pc);
+/* stop and read into value[] */
+void perf_counters_stop(struct perf_counters *pc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
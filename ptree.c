@@ -0,0 +1,323 @@
+#include "ptree.h"
+
+#include <stdlib.h>
+
+static enum rb_color color(struct ptree_node *x) {
+    return x ? x->color : BLACK;
+}
+
+static void ref(struct ptree_node *x) {
+    if (x)
+        __atomic_add_fetch(&x->refs, 1, __ATOMIC_RELAXED);
+}
+
+/* drop one reference; free x and, in turn, its children when it was last */
+static void release(struct ptree_node *x) {
+    while (x && __atomic_sub_fetch(&x->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        struct ptree_node *r = x->right;
+        release(x->left);
+        free(x);
+        x = r;
+    }
+}
+
+/*
+ * Make *slot private to this version. The caller owns the node holding
+ * slot, so a count of 1 means no other version can reach *slot and it may
+ * be changed in place; otherwise it is replaced by a copy.
+ */
+static struct ptree_node *own(struct ptree_node **slot) {
+    struct ptree_node *x = *slot, *y;
+    if (__atomic_load_n(&x->refs, __ATOMIC_ACQUIRE) == 1)
+        return x;
+    y = malloc(sizeof(*y));
+    assert(y);
+    *y = *x;
+    y->refs = 1;
+    ref(y->left);
+    ref(y->right);
+    release(x);
+    *slot = y;
+    return y;
+}
+
+/* the link pointing at path[i] */
+static struct ptree_node **slot_of(struct ptree *pt, struct ptree_node **path, int i) {
+    struct ptree_node *p;
+    if (i == 0)
+        return &pt->root;
+    p = path[i - 1];
+    return p->left == path[i] ? &p->left : &p->right;
+}
+
+/* rotations on owned nodes; *slot is x on entry and its replacement after */
+static void left_rotate(struct ptree_node **slot) {
+    struct ptree_node *x = *slot, *y = x->right;
+    x->right = y->left;
+    y->left = x;
+    *slot = y;
+}
+
+static void right_rotate(struct ptree_node **slot) {
+    struct ptree_node *x = *slot, *y = x->left;
+    x->left = y->right;
+    y->right = x;
+    *slot = y;
+}
+
+void ptree_init(struct ptree *pt, const struct tree *t) {
+    assert(pt);
+    assert(t);
+    pt->keys = *t;
+    pt->root = NULL;
+}
+
+void ptree_destroy(struct ptree *pt) {
+    release(pt->root);
+    pt->root = NULL;
+}
+
+void ptree_snapshot(struct ptree *dst, const struct ptree *src) {
+    assert(dst);
+    assert(src);
+    *dst = *src;
+    ref(dst->root);
+}
+
+struct ptree_node *ptree_search(struct ptree *pt, void *key) {
+    struct ptree_node *x = pt->root;
+    while (x) {
+        int c = tree_key_cmp(&pt->keys, key, x->key);
+        if (c == 0)
+            break;
+        x = c < 0 ? x->left : x->right;
+    }
+    return x;
+}
+
+struct ptree_node *ptree_min(struct ptree *pt) {
+    struct ptree_node *x = pt->root;
+    while (x && x->left)
+        x = x->left;
+    return x;
+}
+
+struct ptree_node *ptree_max(struct ptree *pt) {
+    struct ptree_node *x = pt->root;
+    while (x && x->right)
+        x = x->right;
+    return x;
+}
+
+/* rb_insert_fixup with path[] standing in for the parent links */
+static void insert_fixup(struct ptree *pt, struct ptree_node **path, int i) {
+    while (i >= 2 && color(path[i - 1]) == RED) {
+        struct ptree_node *z = path[i], *p = path[i - 1], *g = path[i - 2], *u;
+        if (p == g->left) {
+            u = g->right;
+            if (color(u) == RED) {
+                u = own(&g->right);
+                p->color = BLACK;
+                u->color = BLACK;
+                g->color = RED;
+                i -= 2;
+                continue;
+            }
+            if (z == p->right) {
+                left_rotate(&g->left);
+                p = z;
+            }
+            p->color = BLACK;
+            g->color = RED;
+            right_rotate(slot_of(pt, path, i - 2));
+        } else {
+            u = g->left;
+            if (color(u) == RED) {
+                u = own(&g->left);
+                p->color = BLACK;
+                u->color = BLACK;
+                g->color = RED;
+                i -= 2;
+                continue;
+            }
+            if (z == p->left) {
+                right_rotate(&g->right);
+                p = z;
+            }
+            p->color = BLACK;
+            g->color = RED;
+            left_rotate(slot_of(pt, path, i - 2));
+        }
+        break;
+    }
+    pt->root->color = BLACK;
+}
+
+struct ptree_node *ptree_insert(struct ptree *pt, void *key, void *data) {
+    struct ptree_node *path[PTREE_MAX_DEPTH], **slot = &pt->root, *z;
+    int n = 0;
+    assert(pt);
+    /* look first, so a duplicate copies nothing */
+    z = ptree_search(pt, key);
+    if (z)
+        return z;
+    while (*slot) {
+        struct ptree_node *x = own(slot);
+        path[n++] = x;
+        slot = tree_key_cmp(&pt->keys, key, x->key) < 0 ? &x->left : &x->right;
+    }
+    z = malloc(sizeof(*z));
+    assert(z);
+    z->left = z->right = NULL;
+    z->key = key;
+    z->data = data;
+    z->refs = 1;
+    z->color = RED;
+    *slot = z;
+    path[n] = z;
+    insert_fixup(pt, path, n);
+    return z;
+}
+
+/*
+ * rb_tree_delete_fixup: the removed black node's place is *slot, under
+ * path[i] (the root if i < 0). Nodes met off the path (the sibling and its
+ * children) are made private before they are recoloured or rotated.
+ */
+static void delete_fixup(struct ptree *pt, struct ptree_node **path, int i,
+                         struct ptree_node **slot) {
+    while (i >= 0 && color(*slot) == BLACK) {
+        struct ptree_node *xp = path[i], *w;
+        if (slot == &xp->left) {
+            w = own(&xp->right);
+            if (w->color == RED) {
+                w->color = BLACK;
+                xp->color = RED;
+                left_rotate(slot_of(pt, path, i));
+                /* w is xp's parent now */
+                path[i + 1] = xp;
+                path[i] = w;
+                i++;
+                w = own(&xp->right);
+            }
+            if (color(w->left) == BLACK && color(w->right) == BLACK) {
+                w->color = RED;
+                slot = slot_of(pt, path, i);
+                i--;
+                continue;
+            }
+            if (color(w->right) == BLACK) {
+                own(&w->left)->color = BLACK;
+                w->color = RED;
+                right_rotate(&xp->right);
+                w = xp->right;
+            }
+            w->color = xp->color;
+            xp->color = BLACK;
+            own(&w->right)->color = BLACK;
+            left_rotate(slot_of(pt, path, i));
+        } else {
+            w = own(&xp->left);
+            if (w->color == RED) {
+                w->color = BLACK;
+                xp->color = RED;
+                right_rotate(slot_of(pt, path, i));
+                path[i + 1] = xp;
+                path[i] = w;
+                i++;
+                w = own(&xp->left);
+            }
+            if (color(w->left) == BLACK && color(w->right) == BLACK) {
+                w->color = RED;
+                slot = slot_of(pt, path, i);
+                i--;
+                continue;
+            }
+            if (color(w->left) == BLACK) {
+                own(&w->right)->color = BLACK;
+                w->color = RED;
+                left_rotate(&xp->left);
+                w = xp->left;
+            }
+            w->color = xp->color;
+            xp->color = BLACK;
+            own(&w->left)->color = BLACK;
+            right_rotate(slot_of(pt, path, i));
+        }
+        return;
+    }
+    if (*slot)
+        own(slot)->color = BLACK;
+}
+
+int ptree_delete(struct ptree *pt, void *key, void **data) {
+    struct ptree_node *path[PTREE_MAX_DEPTH], **slot = &pt->root, *z, *child;
+    int n = 0;
+    enum rb_color removed;
+    assert(pt);
+    if (!ptree_search(pt, key))
+        return 0;
+    for (;;) {
+        int c;
+        z = own(slot);
+        c = tree_key_cmp(&pt->keys, key, z->key);
+        if (c == 0)
+            break;
+        path[n++] = z;
+        slot = c < 0 ? &z->left : &z->right;
+    }
+    if (data)
+        *data = z->data;
+    if (z->left && z->right) {
+        /* z is private: take over the successor's entry and unlink that */
+        struct ptree_node *y;
+        path[n++] = z;
+        slot = &z->right;
+        while ((y = own(slot))->left) {
+            path[n++] = y;
+            slot = &y->left;
+        }
+        z->key = y->key;
+        z->data = y->data;
+        z = y;
+    }
+    child = z->left ? z->left : z->right;
+    *slot = child;
+    removed = z->color;
+    /* child moved up rather than lost a parent: keep its count */
+    z->left = z->right = NULL;
+    release(z);
+    if (removed == BLACK)
+        delete_fixup(pt, path, n - 1, slot);
+    return 1;
+}
+
+void ptree_iter_init(struct ptree_iter *it, struct ptree *pt) {
+    struct ptree_node *x;
+    it->n = 0;
+    for (x = pt->root; x; x = x->left)
+        it->stack[it->n++] = x;
+}
+
+void ptree_iter_seek(struct ptree_iter *it, struct ptree *pt, void *key) {
+    struct ptree_node *x = pt->root;
+    it->n = 0;
+    while (x) {
+        if (tree_key_cmp(&pt->keys, key, x->key) <= 0) {
+            it->stack[it->n++] = x;
+            x = x->left;
+        } else {
+            x = x->right;
+        }
+    }
+}
+
+struct ptree_node *ptree_iter_next(struct ptree_iter *it) {
+    struct ptree_node *x, *y;
+    if (it->n == 0)
+        return NULL;
+    x = it->stack[--it->n];
+    for (y = x->right; y; y = y->left)
+        it->stack[it->n++] = y;
+    return x;
+}
@@ -0,0 +1,66 @@
+#ifndef PTREE_H
+#define PTREE_H
+
+#include "trees.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Persistent red-black tree. Nodes have no parent link, so versions can
+ * share subtrees: an update copies only the O(log n) nodes on its path and
+ * leaves every other version unchanged. Nodes are reference counted; a
+ * node only this version can reach is updated in place instead of copied,
+ * so a tree with no snapshots costs about as much as a mutable one.
+ *
+ * Versions may be read, updated and released from different threads, but
+ * a single version is not shared between a writer and other threads.
+ * Keys and data are not owned and must outlive every version holding them.
+ */
+struct ptree_node {
+    struct ptree_node *left, *right;
+    void *key;
+    void *data;
+    unsigned refs;
+    enum rb_color color;
+};
+
+struct ptree {
+    struct tree keys;   /* only the compare settings are used */
+    struct ptree_node *root;
+};
+
+/* deepest red-black tree a 64-bit address space can hold, plus room */
+#define PTREE_MAX_DEPTH 130
+
+struct ptree_iter {
+    struct ptree_node *stack[PTREE_MAX_DEPTH];
+    int n;
+};
+
+/* compare like t (key_less, key_cmp, int_keys) */
+void ptree_init(struct ptree *pt, const struct tree *t);
+/* drop this version; nodes no other version shares are freed */
+void ptree_destroy(struct ptree *pt);
+/* O(1): dst becomes an independent version equal to src */
+void ptree_snapshot(struct ptree *dst, const struct ptree *src);
+
+struct ptree_node *ptree_search(struct ptree *pt, void *key);
+struct ptree_node *ptree_min(struct ptree *pt);
+struct ptree_node *ptree_max(struct ptree *pt);
+/* returns the node holding key: the new one, or the one already there */
+struct ptree_node *ptree_insert(struct ptree *pt, void *key, void *data);
+/* returns 1 if key was removed; *data (if not NULL) gets its data */
+int ptree_delete(struct ptree *pt, void *key, void **data);
+
+/* in-order scan from the smallest key, or from the first key >= key */
+void ptree_iter_init(struct ptree_iter *it, struct ptree *pt);
+void ptree_iter_seek(struct ptree_iter *it, struct ptree *pt, void *key);
+struct ptree_node *ptree_iter_next(struct ptree_iter *it);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,266 @@
+#include "seq_treap.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+static size_t size_of(struct seq_node *x) {
+    return x ? x->size : 0;
+}
+
+static long sum_of(struct seq_node *x) {
+    return x ? x->sum : 0;
+}
+
+static void apply_rev(struct seq_node *x) {
+    struct seq_node *l;
+    if (!x)
+        return;
+    l = x->left;
+    x->left = x->right;
+    x->right = l;
+    x->rev ^= 1;
+}
+
+static void apply_add(struct seq_node *x, long delta) {
+    if (!x)
+        return;
+    x->val += delta;
+    x->sum += delta * (long)x->size;
+    x->add += delta;
+}
+
+/* hand x's tags to its children */
+static void push(struct seq_node *x) {
+    if (x->rev) {
+        apply_rev(x->left);
+        apply_rev(x->right);
+        x->rev = 0;
+    }
+    if (x->add) {
+        apply_add(x->left, x->add);
+        apply_add(x->right, x->add);
+        x->add = 0;
+    }
+}
+
+static void pull(struct seq_node *x) {
+    x->size = 1 + size_of(x->left) + size_of(x->right);
+    x->sum = x->val + sum_of(x->left) + sum_of(x->right);
+}
+
+static unsigned next_pri(struct seq *s) {
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 7;
+    s->rng ^= s->rng << 17;
+    return (unsigned)(s->rng >> 16);
+}
+
+static struct seq_node *node_new(struct seq *s, long val) {
+    struct seq_node *x = malloc(sizeof(*x));
+    assert(x);
+    x->left = x->right = NULL;
+    x->pri = next_pri(s);
+    x->rev = 0;
+    x->add = 0;
+    x->val = x->sum = val;
+    x->size = 1;
+    return x;
+}
+
+static void free_all(struct seq_node *x) {
+    while (x) {
+        struct seq_node *r = x->right;
+        free_all(x->left);
+        free(x);
+        x = r;
+    }
+}
+
+/* the first k elements of x go to *l, the rest to *r */
+static void split(struct seq_node *x, size_t k, struct seq_node **l,
+                  struct seq_node **r) {
+    if (!x) {
+        *l = *r = NULL;
+        return;
+    }
+    push(x);
+    if (size_of(x->left) >= k) {
+        split(x->left, k, l, &x->left);
+        *r = x;
+    } else {
+        split(x->right, k - size_of(x->left) - 1, &x->right, r);
+        *l = x;
+    }
+    pull(x);
+}
+
+static struct seq_node *merge(struct seq_node *a, struct seq_node *b) {
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+    if (a->pri > b->pri) {
+        push(a);
+        a->right = merge(a->right, b);
+        pull(a);
+        return a;
+    }
+    push(b);
+    b->left = merge(a, b->left);
+    pull(b);
+    return b;
+}
+
+/* node at index i, with the tags on its path pushed */
+static struct seq_node *at(struct seq *s, size_t i) {
+    struct seq_node *x = s->root;
+    assert(i < size_of(x));
+    for (;;) {
+        size_t ls;
+        push(x);
+        ls = size_of(x->left);
+        if (i == ls)
+            return x;
+        if (i < ls) {
+            x = x->left;
+        } else {
+            i -= ls + 1;
+            x = x->right;
+        }
+    }
+}
+
+void seq_init(struct seq *s) {
+    assert(s);
+    s->root = NULL;
+    s->rng = (unsigned long)s | 1;
+}
+
+void seq_destroy(struct seq *s) {
+    free_all(s->root);
+    s->root = NULL;
+}
+
+size_t seq_size(struct seq *s) {
+    return size_of(s->root);
+}
+
+static void pull_all(struct seq_node *x) {
+    if (!x)
+        return;
+    pull_all(x->left);
+    pull_all(x->right);
+    pull(x);
+}
+
+/* Cartesian tree over the values: the right spine is kept on a stack and
+   each new node takes over the part of it with lower priority */
+void seq_build(struct seq *s, const long *vals, size_t n) {
+    struct seq_node **spine;
+    size_t i, top = 0;
+    seq_destroy(s);
+    if (n == 0)
+        return;
+    spine = malloc(n * sizeof(*spine));
+    assert(spine);
+    for (i = 0; i < n; i++) {
+        struct seq_node *x = node_new(s, vals[i]), *last = NULL;
+        while (top && spine[top - 1]->pri < x->pri)
+            last = spine[--top];
+        x->left = last;
+        if (top)
+            spine[top - 1]->right = x;
+        spine[top++] = x;
+    }
+    s->root = spine[0];
+    free(spine);
+    pull_all(s->root);
+}
+
+void seq_insert(struct seq *s, size_t i, long val) {
+    struct seq_node *l, *r;
+    assert(i <= seq_size(s));
+    split(s->root, i, &l, &r);
+    s->root = merge(merge(l, node_new(s, val)), r);
+}
+
+void seq_erase(struct seq *s, size_t lo, size_t hi) {
+    struct seq_node *l, *m, *r;
+    assert(lo <= hi && hi <= seq_size(s));
+    split(s->root, hi, &m, &r);
+    split(m, lo, &l, &m);
+    free_all(m);
+    s->root = merge(l, r);
+}
+
+long seq_get(struct seq *s, size_t i) {
+    return at(s, i)->val;
+}
+
+/* split it out so the sums above it are redone by the merges */
+void seq_set(struct seq *s, size_t i, long val) {
+    struct seq_node *l, *m, *r;
+    assert(i < seq_size(s));
+    split(s->root, i + 1, &m, &r);
+    split(m, i, &l, &m);
+    m->val = m->sum = val;
+    s->root = merge(merge(l, m), r);
+}
+
+static void copy_out(struct seq_node *x, long **out) {
+    while (x) {
+        push(x);
+        copy_out(x->left, out);
+        *(*out)++ = x->val;
+        x = x->right;
+    }
+}
+
+void seq_copy(struct seq *s, size_t lo, size_t hi, long *out) {
+    struct seq_node *l, *m, *r;
+    assert(lo <= hi && hi <= seq_size(s));
+    split(s->root, hi, &m, &r);
+    split(m, lo, &l, &m);
+    copy_out(m, &out);
+    s->root = merge(merge(l, m), r);
+}
+
+void seq_reverse(struct seq *s, size_t lo, size_t hi) {
+    struct seq_node *l, *m, *r;
+    assert(lo <= hi && hi <= seq_size(s));
+    split(s->root, hi, &m, &r);
+    split(m, lo, &l, &m);
+    apply_rev(m);
+    s->root = merge(merge(l, m), r);
+}
+
+void seq_add(struct seq *s, size_t lo, size_t hi, long delta) {
+    struct seq_node *l, *m, *r;
+    assert(lo <= hi && hi <= seq_size(s));
+    split(s->root, hi, &m, &r);
+    split(m, lo, &l, &m);
+    apply_add(m, delta);
+    s->root = merge(merge(l, m), r);
+}
+
+long seq_sum(struct seq *s, size_t lo, size_t hi) {
+    struct seq_node *l, *m, *r;
+    long sum;
+    assert(lo <= hi && hi <= seq_size(s));
+    split(s->root, hi, &m, &r);
+    split(m, lo, &l, &m);
+    sum = sum_of(m);
+    s->root = merge(merge(l, m), r);
+    return sum;
+}
+
+void seq_split(struct seq *s, size_t i, struct seq *right) {
+    assert(i <= seq_size(s));
+    seq_init(right);
+    split(s->root, i, &s->root, &right->root);
+}
+
+void seq_concat(struct seq *s, struct seq *right) {
+    s->root = merge(s->root, right->root);
+    right->root = NULL;
+}
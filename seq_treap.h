@@ -0,0 +1,59 @@
+#ifndef SEQ_TREAP_H
+#define SEQ_TREAP_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Implicit treap: a sequence of longs addressed by position instead of by
+ * key. A node's index is the size of everything left of it, so insert,
+ * erase, split and concat at any position are O(log n) expected. Range
+ * reverse and range add are lazy: they tag the root of the split-off
+ * range and the tags are pushed down only when a path passes through.
+ * Ranges are half-open, [lo, hi).
+ */
+struct seq_node {
+    struct seq_node *left, *right;
+    unsigned pri;
+    /* pending for the children; already applied to this node */
+    int rev;
+    long add;
+    long val;
+    /* over the subtree */
+    long sum;
+    size_t size;
+};
+
+struct seq {
+    struct seq_node *root;
+    unsigned long rng;
+};
+
+void seq_init(struct seq *s);
+void seq_destroy(struct seq *s);
+size_t seq_size(struct seq *s);
+/* replace the contents of s with vals[0..n) in O(n) */
+void seq_build(struct seq *s, const long *vals, size_t n);
+/* the new element gets index i, i <= size */
+void seq_insert(struct seq *s, size_t i, long val);
+void seq_erase(struct seq *s, size_t lo, size_t hi);
+long seq_get(struct seq *s, size_t i);
+void seq_set(struct seq *s, size_t i, long val);
+/* copy [lo, hi) to out in order */
+void seq_copy(struct seq *s, size_t lo, size_t hi, long *out);
+void seq_reverse(struct seq *s, size_t lo, size_t hi);
+void seq_add(struct seq *s, size_t lo, size_t hi, long delta);
+long seq_sum(struct seq *s, size_t lo, size_t hi);
+/* move the elements from index i on into right, which is initialized */
+void seq_split(struct seq *s, size_t i, struct seq *right);
+/* s = s followed by right; right is left empty */
+void seq_concat(struct seq *s, struct seq *right);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
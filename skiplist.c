@@ -0,0 +1,337 @@
+#include "skiplist.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MARKED(p) ((uintptr_t)(p) & 1)
+#define PTR(p) ((struct skiplist_node *)((uintptr_t)(p) & ~(uintptr_t)1))
+#define MARK(p) ((struct skiplist_node *)((uintptr_t)(p) | 1))
+/* sequentially consistent throughout: insert and delete race on a link and
+   a mark in opposite order, and each must see the other's */
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+/* skiplist_enter tries to advance the global epoch this often */
+#define SL_ADVANCE_OPS 32
+
+static int cas(struct skiplist_node **p, struct skiplist_node *old,
+               struct skiplist_node *new) {
+    return __atomic_compare_exchange_n(p, &old, new, 0, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+}
+
+static int deleted(struct skiplist_node *x) {
+    return MARKED(LOAD(x->next[0]));
+}
+
+static struct skiplist_node *node_alloc(int height) {
+    struct skiplist_node *x;
+    x = malloc(sizeof(*x) + height * sizeof(struct skiplist_node *));
+    assert(x);
+    x->height = height;
+    x->retired = NULL;
+    x->pending = 2;
+    return x;
+}
+
+static void free_list(struct skiplist_node *x) {
+    while (x) {
+        struct skiplist_node *next = x->retired;
+        free(x);
+        x = next;
+    }
+}
+
+void skiplist_init(struct skiplist *sl, const struct tree *t) {
+    int i;
+    assert(sl);
+    assert(t);
+    sl->keys = *t;
+    sl->head = node_alloc(SKIPLIST_MAX_LEVEL);
+    sl->head->key = sl->head->data = NULL;
+    for (i = 0; i < SKIPLIST_MAX_LEVEL; i++)
+        sl->head->next[i] = NULL;
+    sl->epoch = 1;
+    sl->threads = NULL;
+    sl->orphans = NULL;
+    pthread_mutex_init(&sl->lock, NULL);
+}
+
+void skiplist_destroy(struct skiplist *sl) {
+    struct skiplist_node *x = sl->head;
+    assert(!sl->threads);
+    while (x) {
+        struct skiplist_node *next = PTR(x->next[0]);
+        free(x);
+        x = next;
+    }
+    free_list(sl->orphans);
+    pthread_mutex_destroy(&sl->lock);
+}
+
+void skiplist_thread_register(struct skiplist *sl, struct skiplist_thread *th) {
+    th->epoch = 0;
+    th->seen = 0;
+    th->limbo[0] = th->limbo[1] = th->limbo[2] = NULL;
+    th->rng = (uintptr_t)th | 1;
+    th->ops = 0;
+    pthread_mutex_lock(&sl->lock);
+    th->next = sl->threads;
+    sl->threads = th;
+    pthread_mutex_unlock(&sl->lock);
+}
+
+/* entries th retired but could not free yet wait for skiplist_destroy */
+void skiplist_thread_unregister(struct skiplist *sl, struct skiplist_thread *th) {
+    struct skiplist_thread **pp;
+    int i;
+    pthread_mutex_lock(&sl->lock);
+    for (pp = &sl->threads; *pp != th; pp = &(*pp)->next)
+        ;
+    *pp = th->next;
+    for (i = 0; i < 3; i++) {
+        struct skiplist_node *x = th->limbo[i];
+        while (x) {
+            struct skiplist_node *next = x->retired;
+            x->retired = sl->orphans;
+            sl->orphans = x;
+            x = next;
+        }
+    }
+    pthread_mutex_unlock(&sl->lock);
+}
+
+/* move to the next epoch once every thread inside has seen this one */
+static void try_advance(struct skiplist *sl) {
+    struct skiplist_thread *th;
+    unsigned long e = __atomic_load_n(&sl->epoch, __ATOMIC_SEQ_CST);
+    if (pthread_mutex_trylock(&sl->lock))
+        return;
+    for (th = sl->threads; th; th = th->next) {
+        unsigned long v = __atomic_load_n(&th->epoch, __ATOMIC_SEQ_CST);
+        if (v && v != e) {
+            pthread_mutex_unlock(&sl->lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&sl->lock);
+    __atomic_compare_exchange_n(&sl->epoch, &e, e + 1, 0, __ATOMIC_SEQ_CST,
+                                __ATOMIC_SEQ_CST);
+}
+
+/*
+ * An entry retired while this thread was in epoch a was unlinked while the
+ * global epoch was a or a + 1, so by epoch a + 3 nobody can reach it: the
+ * limbo bag for e % 3 is freed on first entering epoch e and then reused.
+ */
+void skiplist_enter(struct skiplist *sl, struct skiplist_thread *th) {
+    unsigned long e;
+    if (++th->ops % SL_ADVANCE_OPS == 0)
+        try_advance(sl);
+    e = __atomic_load_n(&sl->epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&th->epoch, e, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (th->seen != e) {
+        free_list(th->limbo[e % 3]);
+        th->limbo[e % 3] = NULL;
+        th->seen = e;
+    }
+}
+
+void skiplist_exit(struct skiplist_thread *th) {
+    __atomic_store_n(&th->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Called by the inserter once it links nothing more and by the deleter once
+ * it has unlinked x, each after a find that ran past x's last link. Only
+ * the second of the two puts x in limbo: before then the inserter may still
+ * link x back in on an upper level, and a later reader could reach it.
+ */
+static void release(struct skiplist_thread *th, struct skiplist_node *x) {
+    if (__atomic_sub_fetch(&x->pending, 1, __ATOMIC_SEQ_CST))
+        return;
+    x->retired = th->limbo[th->seen % 3];
+    th->limbo[th->seen % 3] = x;
+}
+
+/* geometric heights, p = 1/4 */
+static int random_level(struct skiplist_thread *th) {
+    unsigned long r;
+    int h = 1;
+    th->rng ^= th->rng << 13;
+    th->rng ^= th->rng >> 7;
+    th->rng ^= th->rng << 17;
+    r = th->rng;
+    while ((r & 3) == 0 && h < SKIPLIST_MAX_LEVEL) {
+        h++;
+        r >>= 2;
+    }
+    return h;
+}
+
+/*
+ * Fill preds/succs with the nodes around key on every level, unlinking
+ * deleted nodes met on the way. Returns 1 if succs[0] holds key.
+ */
+static int find(struct skiplist *sl, void *key, struct skiplist_node **preds,
+                struct skiplist_node **succs) {
+    struct skiplist_node *pred, *curr, *succ;
+    int lv;
+retry:
+    pred = sl->head;
+    for (lv = SKIPLIST_MAX_LEVEL - 1; lv >= 0; lv--) {
+        curr = PTR(LOAD(pred->next[lv]));
+        while (curr) {
+            succ = LOAD(curr->next[lv]);
+            if (MARKED(succ)) {
+                if (!cas(&pred->next[lv], curr, PTR(succ)))
+                    goto retry;
+                curr = PTR(succ);
+            } else if (tree_key_cmp(&sl->keys, curr->key, key) < 0) {
+                pred = curr;
+                curr = succ;
+            } else {
+                break;
+            }
+        }
+        preds[lv] = pred;
+        succs[lv] = curr;
+    }
+    return succs[0] && tree_key_cmp(&sl->keys, succs[0]->key, key) == 0;
+}
+
+/* first live node with key >= key; never writes */
+struct skiplist_node *skiplist_lower_bound(struct skiplist *sl, void *key) {
+    struct skiplist_node *pred = sl->head, *curr = NULL, *succ;
+    int lv;
+    for (lv = SKIPLIST_MAX_LEVEL - 1; lv >= 0; lv--) {
+        curr = PTR(LOAD(pred->next[lv]));
+        while (curr) {
+            succ = LOAD(curr->next[lv]);
+            if (MARKED(succ)) {
+                curr = PTR(succ);
+            } else if (tree_key_cmp(&sl->keys, curr->key, key) < 0) {
+                pred = curr;
+                curr = succ;
+            } else {
+                break;
+            }
+        }
+    }
+    return curr;
+}
+
+struct skiplist_node *skiplist_search(struct skiplist *sl, void *key) {
+    struct skiplist_node *x = skiplist_lower_bound(sl, key);
+    if (x && tree_key_cmp(&sl->keys, x->key, key) == 0)
+        return x;
+    return NULL;
+}
+
+struct skiplist_node *skiplist_insert(struct skiplist *sl, struct skiplist_thread *th,
+                                      void *key, void *data) {
+    struct skiplist_node *preds[SKIPLIST_MAX_LEVEL], *succs[SKIPLIST_MAX_LEVEL];
+    struct skiplist_node *x = NULL;
+    int i;
+    for (;;) {
+        if (find(sl, key, preds, succs)) {
+            free(x);
+            return succs[0];
+        }
+        if (!x) {
+            x = node_alloc(random_level(th));
+            x->key = key;
+            x->data = data;
+        }
+        for (i = 0; i < x->height; i++)
+            x->next[i] = succs[i];
+        if (cas(&preds[0]->next[0], succs[0], x))
+            break;
+    }
+    /* x is in the map now; the upper levels only speed up searches */
+    for (i = 1; i < x->height; i++) {
+        for (;;) {
+            struct skiplist_node *cur = LOAD(x->next[i]);
+            /* a deleted node with our key may still sit here: make find
+               unlink it, so x never lands in front of it */
+            if (succs[i] && succs[i] != x &&
+                tree_key_cmp(&sl->keys, succs[i]->key, key) == 0) {
+                find(sl, key, preds, succs);
+                if (succs[0] != x)
+                    goto done;
+                continue;
+            }
+            if (MARKED(cur))
+                goto done;
+            if (cur != succs[i] && !cas(&x->next[i], cur, succs[i]))
+                goto done;
+            if (cas(&preds[i]->next[i], succs[i], x))
+                break;
+            find(sl, key, preds, succs);
+            if (succs[0] != x)
+                goto done;
+        }
+    }
+done:
+    /* deleted while we were linking: the deleter's find may have run before
+       our last link, so unlink x ourselves */
+    if (deleted(x))
+        find(sl, key, preds, succs);
+    release(th, x);
+    return x;
+}
+
+int skiplist_delete(struct skiplist *sl, struct skiplist_thread *th, void *key,
+                    void **data) {
+    struct skiplist_node *preds[SKIPLIST_MAX_LEVEL], *succs[SKIPLIST_MAX_LEVEL];
+    struct skiplist_node *x, *succ;
+    int i;
+    if (!find(sl, key, preds, succs))
+        return 0;
+    x = succs[0];
+    /* mark top-down; whoever marks level 0 owns the delete */
+    for (i = x->height - 1; i >= 1; i--) {
+        succ = LOAD(x->next[i]);
+        while (!MARKED(succ) && !cas(&x->next[i], succ, MARK(succ)))
+            succ = LOAD(x->next[i]);
+    }
+    for (;;) {
+        succ = LOAD(x->next[0]);
+        if (MARKED(succ))
+            return 0;
+        if (cas(&x->next[0], succ, MARK(succ)))
+            break;
+    }
+    if (data)
+        *data = x->data;
+    find(sl, key, preds, succs);
+    release(th, x);
+    return 1;
+}
+
+static struct skiplist_node *first_live(struct skiplist_node *x) {
+    while (x && deleted(x))
+        x = PTR(LOAD(x->next[0]));
+    return x;
+}
+
+struct skiplist_node *skiplist_min(struct skiplist *sl) {
+    return first_live(PTR(LOAD(sl->head->next[0])));
+}
+
+struct skiplist_node *skiplist_successor(struct skiplist *sl, struct skiplist_node *x) {
+    (void)sl;
+    return first_live(PTR(LOAD(x->next[0])));
+}
+
+/* rightmost live node, stepping over deleted ones on every level */
+struct skiplist_node *skiplist_max(struct skiplist *sl) {
+    struct skiplist_node *pred = sl->head, *curr;
+    int lv;
+    for (lv = SKIPLIST_MAX_LEVEL - 1; lv >= 0; lv--) {
+        for (curr = PTR(LOAD(pred->next[lv])); curr; curr = PTR(LOAD(curr->next[lv]))) {
+            if (!deleted(curr))
+                pred = curr;
+        }
+    }
+    return pred == sl->head ? NULL : pred;
+}
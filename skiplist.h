@@ -0,0 +1,83 @@
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
+#include <pthread.h>
+
+#include "trees.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Lock-free ordered map: a skip list in the style of Fraser, with deleted
+ * links marked in their low bit and every change made by compare-and-swap.
+ * Keys are unique and ordered like a struct tree's (key_cmp, key_less or
+ * int_keys).
+ *
+ * Memory is reclaimed by epochs. Each thread registers a skiplist_thread
+ * and brackets its operations with skiplist_enter/skiplist_exit. Entries
+ * returned inside that bracket stay readable until skiplist_exit. Removed
+ * entries are freed once no thread can still be looking at them.
+ */
+#define SKIPLIST_MAX_LEVEL 24
+
+struct skiplist_node {
+    void *key;
+    void *data;
+    struct skiplist_node *retired;  /* limbo list link */
+    int height;
+    /* the insert and the delete each drop one when done with the node;
+       whichever drops the last retires it */
+    int pending;
+    struct skiplist_node *next[];   /* low bit set: this node is deleted */
+};
+
+struct skiplist_thread {
+    /* epoch seen at skiplist_enter, 0 outside */
+    unsigned long epoch __attribute__((aligned(64)));
+    unsigned long seen;
+    struct skiplist_node *limbo[3];
+    unsigned long rng;
+    unsigned ops;
+    struct skiplist_thread *next;
+};
+
+struct skiplist {
+    struct tree keys;   /* only the compare settings are used */
+    struct skiplist_node *head;
+    unsigned long epoch;
+    struct skiplist_thread *threads;
+    struct skiplist_node *orphans;  /* limbo of threads that left */
+    pthread_mutex_t lock;
+};
+
+/* compare like t (key_less, key_cmp, int_keys) */
+void skiplist_init(struct skiplist *sl, const struct tree *t);
+/* frees every entry; no thread may be registered */
+void skiplist_destroy(struct skiplist *sl);
+
+void skiplist_thread_register(struct skiplist *sl, struct skiplist_thread *th);
+void skiplist_thread_unregister(struct skiplist *sl, struct skiplist_thread *th);
+void skiplist_enter(struct skiplist *sl, struct skiplist_thread *th);
+void skiplist_exit(struct skiplist_thread *th);
+
+/* the calls below must be made between skiplist_enter and skiplist_exit;
+   NULL means no such entry */
+struct skiplist_node *skiplist_search(struct skiplist *sl, void *key);
+/* returns the new entry, or the one already holding key */
+struct skiplist_node *skiplist_insert(struct skiplist *sl, struct skiplist_thread *th,
+                                      void *key, void *data);
+/* returns 1 if this call removed key; *data (if not NULL) gets its data */
+int skiplist_delete(struct skiplist *sl, struct skiplist_thread *th, void *key,
+                    void **data);
+struct skiplist_node *skiplist_min(struct skiplist *sl);
+struct skiplist_node *skiplist_max(struct skiplist *sl);
+struct skiplist_node *skiplist_successor(struct skiplist *sl, struct skiplist_node *x);
+struct skiplist_node *skiplist_lower_bound(struct skiplist *sl, void *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,12 +1,15 @@
 #!/bin/bash
+# Sweep the workload engine over sizes and workloads into one CSV: a row
+# per tree, run and phase, plus a "mean" row over the runs; see
+# ./workload help for the spec keys.
 
-echo type height,insert_time,search_time,delete_time
-
-NUM="1"
-ZZZ="0"
-for i in $(seq 1 6); do
-    NUM="${NUM}${ZZZ}"
-    for j in $(seq 1 10); do
-        ./benchmark "$NUM"
+header=1
+for n in 1000 10000 100000 1000000; do
+    for spec in "mix=C" "mix=A" "mix=E" \
+                "load=sorted trees=rb,avl,treap,btree" \
+                "keys=int mix=B" "keys=int load=nearly mix=D miss=0.1" \
+                "klen=64 prefix=48 mix=F"; do
+        ./workload n="$n" ops="$n" runs=5 $spec | tail -n +$((header ? 1 : 2))
+        header=0
     done
 done
@@ -0,0 +1,302 @@
+#include "tree_dump.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* a multiple of 8, so every flush but the last feeds whole words to the sum */
+#define DUMP_BUF (1 << 20)
+
+struct dump_io {
+    int fd;
+    unsigned char *buf;
+    size_t pos, len;    /* write: bytes queued; read: cursor and fill */
+    uint64_t sum;
+    long long total;
+};
+
+/* word-at-a-time mixing checksum; a trailing partial word is zero padded */
+static uint64_t checksum(uint64_t h, const unsigned char *p, size_t len) {
+    uint64_t w;
+    while (len >= 8) {
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+        p += 8;
+        len -= 8;
+    }
+    if (len) {
+        w = 0;
+        memcpy(&w, p, len);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static int io_flush(struct dump_io *io) {
+    const unsigned char *p = io->buf;
+    size_t len = io->pos;
+    io->sum = checksum(io->sum, io->buf, io->pos);
+    while (len) {
+        ssize_t n = write(io->fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    io->total += io->pos;
+    io->pos = 0;
+    return 0;
+}
+
+static int io_put(struct dump_io *io, const void *src, size_t len) {
+    const unsigned char *p = src;
+    while (len) {
+        size_t n = DUMP_BUF - io->pos;
+        if (n > len)
+            n = len;
+        memcpy(io->buf + io->pos, p, n);
+        io->pos += n;
+        p += n;
+        len -= n;
+        if (io->pos == DUMP_BUF && io_flush(io))
+            return -1;
+    }
+    return 0;
+}
+
+static int io_put_varint(struct dump_io *io, uint64_t v) {
+    unsigned char b[10];
+    int n = 0;
+    while (v >= 0x80) {
+        b[n++] = (unsigned char)v | 0x80;
+        v >>= 7;
+    }
+    b[n++] = (unsigned char)v;
+    return io_put(io, b, n);
+}
+
+long long tree_dump_save(int fd, struct tree *t, tree_file_bytes_fn key,
+                         tree_file_bytes_fn data, void *ctx, int flags) {
+    struct dump_io io = {fd, NULL, 0, 0, 0, 0};
+    struct tree_node *x;
+    const unsigned char *prev = NULL;
+    size_t prevlen = 0;
+    uint64_t count = 0, sum;
+    int err;
+    assert(t);
+    assert(key);
+    io.buf = malloc(DUMP_BUF);
+    if (!io.buf)
+        return -1;
+    if (io_put(&io, TREE_DUMP_MAGIC, 8) || io_put_varint(&io, flags))
+        goto fail;
+    /* a single in-order walk: the first varint of a record is stored plus
+       one, so a 0 can end the list and the count goes after it */
+    for (x = tree_min(t, t->root); x != t_nil; x = tree_successor(t, x)) {
+        size_t klen, dlen = 0, shared = 0;
+        const unsigned char *k = key(x->key, &klen, ctx);
+        const void *d = data ? data(x->data, &dlen, ctx) : NULL;
+        if (flags & TREE_DUMP_PREFIX) {
+            while (shared < klen && shared < prevlen && k[shared] == prev[shared])
+                shared++;
+            if (io_put_varint(&io, shared + 1) || io_put_varint(&io, klen - shared))
+                goto fail;
+        } else if (io_put_varint(&io, klen + 1)) {
+            goto fail;
+        }
+        if (io_put(&io, k + shared, klen - shared) || io_put_varint(&io, dlen) ||
+            io_put(&io, d, dlen))
+            goto fail;
+        prev = k;
+        prevlen = klen;
+        count++;
+    }
+    if (io_put_varint(&io, 0) || io_put_varint(&io, count))
+        goto fail;
+    /* the checksum covers everything before it */
+    if (io_flush(&io))
+        goto fail;
+    sum = io.sum;
+    if (io_put(&io, &sum, sizeof(sum)) || io_flush(&io))
+        goto fail;
+    free(io.buf);
+    return io.total;
+
+fail:
+    err = errno;
+    free(io.buf);
+    errno = err;
+    return -1;
+}
+
+/* consumed bytes are summed a whole word at a time as the buffer refills;
+   fewer than 8 stay at the front until the next refill */
+static void io_sum_consumed(struct dump_io *io, int all) {
+    size_t s = all ? io->pos : io->pos & ~(size_t)7;
+    io->sum = checksum(io->sum, io->buf, s);
+    io->total += s;
+    memmove(io->buf, io->buf + s, io->len - s);
+    io->len -= s;
+    io->pos -= s;
+}
+
+static int io_fill(struct dump_io *io) {
+    ssize_t n;
+    io_sum_consumed(io, 0);
+    do {
+        n = read(io->fd, io->buf + io->len, DUMP_BUF - io->len);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return -1;
+    if (n == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    io->len += n;
+    return 0;
+}
+
+static int io_get(struct dump_io *io, void *dst, size_t len) {
+    unsigned char *p = dst;
+    while (len) {
+        size_t n = io->len - io->pos;
+        if (n == 0) {
+            if (io_fill(io))
+                return -1;
+            continue;
+        }
+        if (n > len)
+            n = len;
+        memcpy(p, io->buf + io->pos, n);
+        io->pos += n;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int io_get_varint(struct dump_io *io, uint64_t *v) {
+    unsigned char b;
+    int shift = 0;
+    *v = 0;
+    do {
+        if (shift > 63 || io_get(io, &b, 1))
+            return -1;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return 0;
+}
+
+/* grow *buf to hold at least len bytes */
+static int reserve(unsigned char **buf, size_t *cap, size_t len) {
+    unsigned char *b;
+    size_t c = *cap ? *cap : 64;
+    if (len <= *cap)
+        return 0;
+    if (len > SIZE_MAX / 2)
+        return -1;
+    while (c < len)
+        c *= 2;
+    b = realloc(*buf, c);
+    if (!b)
+        return -1;
+    *buf = b;
+    *cap = c;
+    return 0;
+}
+
+long long tree_dump_load(int fd, struct tree *t, tree_dump_node_fn make,
+                         tree_drop_fn drop, void *ctx) {
+    struct dump_io io = {fd, NULL, 0, 0, 0, 0};
+    struct tree_node **nodes = NULL;
+    unsigned char *k = NULL, *d = NULL;
+    size_t kcap = 0, dcap = 0, ncap = 0, klen = 0, i, n = 0;
+    uint64_t flags, head, shared = 0, len, dlen, count, sum;
+    char magic[8];
+    int err;
+    assert(t);
+    assert(t->root == t_nil);
+    io.buf = malloc(DUMP_BUF);
+    if (!io.buf)
+        return -1;
+    errno = EINVAL;
+    if (io_get(&io, magic, 8) || memcmp(magic, TREE_DUMP_MAGIC, 8) ||
+        io_get_varint(&io, &flags))
+        goto fail;
+    for (;;) {
+        if (io_get_varint(&io, &head))
+            goto fail;
+        if (head == 0)
+            break;
+        if (flags & TREE_DUMP_PREFIX) {
+            shared = head - 1;
+            if (io_get_varint(&io, &len))
+                goto fail;
+        } else {
+            len = head - 1;
+        }
+        if (shared > klen || len > SIZE_MAX / 2 ||
+            reserve(&k, &kcap, shared + len) || io_get(&io, k + shared, len) ||
+            io_get_varint(&io, &dlen) || reserve(&d, &dcap, dlen) ||
+            io_get(&io, d, dlen))
+            goto fail;
+        if (n == ncap) {
+            struct tree_node **nn;
+            ncap = ncap ? ncap * 2 : 1024;
+            nn = realloc(nodes, ncap * sizeof(*nodes));
+            if (!nn)
+                goto fail;
+            nodes = nn;
+        }
+        klen = shared + len;
+        nodes[n] = make(k, klen, d, dlen, ctx);
+        if (!nodes[n]) {
+            errno = ENOMEM;
+            goto fail;
+        }
+        n++;
+    }
+    if (io_get_varint(&io, &count) || count != n)
+        goto fail;
+    /* sum what was read before the stored checksum, then compare */
+    io_sum_consumed(&io, 1);
+    if (io_get(&io, &sum, sizeof(sum)))
+        goto fail;
+    if (sum != io.sum) {
+        errno = EILSEQ;
+        goto fail;
+    }
+    io.total += sizeof(sum);
+    /* saved in the order of the tree it came from, which t must share */
+    for (i = 1; i < n; i++) {
+        if (tree_key_cmp(t, nodes[i - 1]->key, nodes[i]->key) >= 0) {
+            errno = EINVAL;
+            goto fail;
+        }
+    }
+    tree_build_sorted(t, nodes, n);
+    free(nodes);
+    free(k);
+    free(d);
+    free(io.buf);
+    return io.total;
+
+fail:
+    err = errno;
+    for (i = 0; i < n && drop; i++)
+        drop(nodes[i], ctx);
+    free(nodes);
+    free(k);
+    free(d);
+    free(io.buf);
+    errno = err;
+    return -1;
+}
@@ -0,0 +1,43 @@
+#ifndef TREE_DUMP_H
+#define TREE_DUMP_H
+
+#include "trees.h"
+#include "tree_file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Streaming checkpoint of a tree: a header, one record per node in key
+ * order, an end mark and the node count, then a checksum of everything
+ * before it. Saving walks the tree once and needs no seekable fd. A record is the key
+ * and data bytes, each behind a varint length; with TREE_DUMP_PREFIX a key
+ * is stored as the number of leading bytes it shares with the previous key
+ * plus the rest. Restore collects the nodes and links them with
+ * tree_build_sorted, so it is linear in the number of keys.
+ */
+#define TREE_DUMP_MAGIC "TREEDMP1"
+#define TREE_DUMP_PREFIX 1
+
+/* build a node (and its key and data objects) from the stored bytes */
+typedef struct tree_node *(*tree_dump_node_fn)(const void *key, size_t klen,
+                                               const void *data, size_t dlen,
+                                               void *ctx);
+
+/* write t to fd; data may be NULL. Returns bytes written, or -1 with errno */
+long long tree_dump_save(int fd, struct tree *t, tree_file_bytes_fn key,
+                         tree_file_bytes_fn data, void *ctx, int flags);
+/* read a dump from fd into the empty tree t. make returns NULL if out of
+   memory. On a bad or truncated stream, a failed make, or keys that are not
+   strictly ascending under t's order, the nodes made so far go to drop (may
+   be NULL), t stays empty and -1 is returned with errno set; otherwise the
+   number of bytes read */
+long long tree_dump_load(int fd, struct tree *t, tree_dump_node_fn make,
+                         tree_drop_fn drop, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
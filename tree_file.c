@@ -0,0 +1,277 @@
+#include "tree_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* the entry array starts at a multiple of this */
+#define TF_ALIGN 64
+
+struct tf_rec {
+    const void *key, *data;
+    size_t klen, dlen;
+    uint64_t prefix;
+};
+
+static uint64_t key_prefix(const void *key, size_t len) {
+    const unsigned char *k = key;
+    uint64_t p = 0;
+    size_t i;
+    for (i = 0; i < 8; i++)
+        p = p << 8 | (i < len ? k[i] : 0);
+    return p;
+}
+
+static int bytes_cmp(const void *a, size_t alen, const void *b, size_t blen) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c)
+        return c;
+    return (alen > blen) - (alen < blen);
+}
+
+static int rec_cmp(const void *a, const void *b) {
+    const struct tf_rec *x = a, *y = b;
+    if (x->prefix != y->prefix)
+        return x->prefix < y->prefix ? -1 : 1;
+    return bytes_cmp(x->key, x->klen, y->key, y->klen);
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int tree_file_write(const char *path, struct tree *t, tree_file_bytes_fn key,
+                    tree_file_bytes_fn data, void *ctx) {
+    struct tree_file_header h;
+    struct tree_file_entry *es = NULL;
+    struct tf_rec *recs = NULL;
+    struct tree_node *x;
+    size_t n = 0, cap = 0, i, tmplen = strlen(path) + 5;
+    uint64_t off;
+    char *tmp = malloc(tmplen);
+    int fd = -1, err;
+    static const char pad[TF_ALIGN];
+    assert(t);
+    assert(key);
+    if (!tmp)
+        return -1;
+    snprintf(tmp, tmplen, "%s.tmp", path);
+    for (x = tree_min(t, t->root); x != t_nil; x = tree_successor(t, x)) {
+        if (n == cap) {
+            struct tf_rec *r;
+            cap = cap ? cap * 2 : 1024;
+            r = realloc(recs, cap * sizeof(*recs));
+            if (!r)
+                goto fail;
+            recs = r;
+        }
+        recs[n].key = key(x->key, &recs[n].klen, ctx);
+        recs[n].dlen = 0;
+        recs[n].data = data ? data(x->data, &recs[n].dlen, ctx) : NULL;
+        recs[n].prefix = key_prefix(recs[n].key, recs[n].klen);
+        n++;
+    }
+    /* the tree's order need not be byte order */
+    qsort(recs, n, sizeof(*recs), rec_cmp);
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TREE_FILE_MAGIC, sizeof(h.magic));
+    h.count = n;
+    h.entries = (sizeof(h) + TF_ALIGN - 1) / TF_ALIGN * TF_ALIGN;
+    es = malloc(n * sizeof(*es) + 1);
+    if (!es)
+        goto fail;
+    off = h.entries + n * sizeof(*es);
+    for (i = 0; i < n; i++) {
+        es[i].prefix = recs[i].prefix;
+        es[i].off = off;
+        es[i].klen = recs[i].klen;
+        es[i].dlen = recs[i].dlen;
+        off += recs[i].klen + recs[i].dlen;
+    }
+    h.size = off;
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        goto fail;
+    if (write_all(fd, &h, sizeof(h)) ||
+        write_all(fd, pad, h.entries - sizeof(h)) ||
+        write_all(fd, es, n * sizeof(*es)))
+        goto fail;
+    for (i = 0; i < n; i++) {
+        if (write_all(fd, recs[i].key, recs[i].klen) ||
+            write_all(fd, recs[i].data, recs[i].dlen))
+            goto fail;
+    }
+    if (fsync(fd) || close(fd)) {
+        fd = -1;
+        goto fail;
+    }
+    fd = -1;
+    if (rename(tmp, path))
+        goto fail;
+    free(es);
+    free(recs);
+    free(tmp);
+    return 0;
+
+fail:
+    err = errno;
+    if (fd >= 0)
+        close(fd);
+    unlink(tmp);
+    free(es);
+    free(recs);
+    free(tmp);
+    errno = err;
+    return -1;
+}
+
+/* the entry array lies inside the size-byte map, without overflow however
+   the fields are set; O(1), so open stays ready to query at once */
+static int tf_valid(const unsigned char *base, size_t size) {
+    const struct tree_file_header *h = (const struct tree_file_header *)base;
+    return !memcmp(h->magic, TREE_FILE_MAGIC, sizeof(h->magic)) &&
+           h->size == size && h->entries >= sizeof(*h) && h->entries <= size &&
+           h->entries % TF_ALIGN == 0 &&
+           h->count <= (size - h->entries) / sizeof(struct tree_file_entry);
+}
+
+/* the entry's key and data bytes lie inside the map; checked on each use */
+static int entry_ok(const struct tree_file *f, const struct tree_file_entry *e) {
+    return e->off <= f->size && (uint64_t)e->klen + e->dlen <= f->size - e->off;
+}
+
+int tree_file_open(struct tree_file *f, const char *path, int writable) {
+    const struct tree_file_header *h;
+    struct stat st;
+    void *base;
+    int fd = open(path, O_RDONLY);
+    assert(f);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(*h)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ | (writable ? PROT_WRITE : 0),
+                MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+    h = base;
+    if (!tf_valid(base, st.st_size)) {
+        munmap(base, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    f->base = base;
+    f->size = st.st_size;
+    f->e = (const struct tree_file_entry *)(f->base + h->entries);
+    f->count = h->count;
+    return 0;
+}
+
+void tree_file_close(struct tree_file *f) {
+    munmap(f->base, f->size);
+    f->base = NULL;
+    f->size = 0;
+    f->count = 0;
+}
+
+int tree_file_verify(const struct tree_file *f) {
+    size_t i;
+    for (i = 0; i < f->count; i++) {
+        if (!entry_ok(f, &f->e[i])) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int entry_cmp(const struct tree_file *f, const struct tree_file_entry *e,
+                     uint64_t prefix, const void *key, size_t len) {
+    if (e->prefix != prefix)
+        return e->prefix < prefix ? -1 : 1;
+    if (!entry_ok(f, e))
+        return bytes_cmp(f->base, 0, key, len);
+    return bytes_cmp(f->base + e->off, e->klen, key, len);
+}
+
+size_t tree_file_lower_bound(const struct tree_file *f, const void *key, size_t len) {
+    uint64_t prefix = key_prefix(key, len);
+    size_t lo = 0, hi = f->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entry_cmp(f, &f->e[mid], prefix, key, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+long tree_file_find(const struct tree_file *f, const void *key, size_t len) {
+    size_t i = tree_file_lower_bound(f, key, len);
+    if (i < f->count && entry_cmp(f, &f->e[i], key_prefix(key, len), key, len) == 0)
+        return (long)i;
+    return -1;
+}
+
+const void *tree_file_key(const struct tree_file *f, size_t i, size_t *len) {
+    assert(i < f->count);
+    if (!entry_ok(f, &f->e[i])) {
+        *len = 0;
+        return NULL;
+    }
+    *len = f->e[i].klen;
+    return f->base + f->e[i].off;
+}
+
+void *tree_file_data(const struct tree_file *f, size_t i, size_t *len) {
+    assert(i < f->count);
+    if (!entry_ok(f, &f->e[i])) {
+        *len = 0;
+        return NULL;
+    }
+    *len = f->e[i].dlen;
+    return f->base + f->e[i].off + f->e[i].klen;
+}
+
+int tree_file_range(const struct tree_file *f, const void *lo, size_t lolen,
+                    const void *hi, size_t hilen,
+                    int (*fn)(const struct tree_file *f, size_t i, void *ctx),
+                    void *ctx) {
+    uint64_t hp = key_prefix(hi, hilen);
+    size_t i;
+    int r = 0;
+    for (i = tree_file_lower_bound(f, lo, lolen); i < f->count; i++) {
+        if (entry_cmp(f, &f->e[i], hp, hi, hilen) > 0)
+            break;
+        r = fn(f, i, ctx);
+        if (r)
+            break;
+    }
+    return r;
+}
@@ -0,0 +1,82 @@
+#ifndef TREE_FILE_H
+#define TREE_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trees.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * On-disk snapshot of a tree that is searched in place through mmap.
+ *
+ * The file holds a header, then one fixed-size entry per key in byte
+ * order (memcmp, shorter first on a tie), then the key and data bytes.
+ * Entries refer to bytes by offset from the start of the file, so there is
+ * nothing to fix up on open. The sorted entry array acts as an implicit
+ * balanced tree: lookups binary-search it, and range scans walk it.
+ * Integers are stored in host byte order.
+ */
+#define TREE_FILE_MAGIC "TREEFIL1"
+
+struct tree_file_header {
+    char magic[8];
+    uint64_t count;
+    uint64_t entries;   /* offset of the entry array */
+    uint64_t size;      /* whole file */
+};
+
+struct tree_file_entry {
+    uint64_t prefix;    /* first 8 key bytes, big-endian, zero padded */
+    uint64_t off;       /* key bytes, followed by the data bytes */
+    uint32_t klen;
+    uint32_t dlen;
+};
+
+struct tree_file {
+    unsigned char *base;
+    size_t size;
+    const struct tree_file_entry *e;
+    size_t count;
+};
+
+/* returns the bytes of a key or data pointer and stores their length */
+typedef const void *(*tree_file_bytes_fn)(void *p, size_t *len, void *ctx);
+
+/* write t to path (through path.tmp and a rename); data may be NULL.
+   Returns 0, or -1 with errno set */
+int tree_file_write(const char *path, struct tree *t, tree_file_bytes_fn key,
+                    tree_file_bytes_fn data, void *ctx);
+/* map path; writable maps it copy-on-write, so tree_file_data may be
+   changed in place without touching the file. Only the header is checked,
+   in O(1), so nothing but the pages a query touches is read. Returns 0, or
+   -1 (EINVAL if the header is malformed) */
+int tree_file_open(struct tree_file *f, const char *path, int writable);
+void tree_file_close(struct tree_file *f);
+/* check every entry against the file size, reading the whole entry array.
+   Optional: an entry whose bytes fall outside the file is caught when
+   used, and reads as an empty key. Returns 0, or -1 with errno EINVAL */
+int tree_file_verify(const struct tree_file *f);
+
+/* index of key, or -1 */
+long tree_file_find(const struct tree_file *f, const void *key, size_t len);
+/* index of the first key >= key; f->count if none */
+size_t tree_file_lower_bound(const struct tree_file *f, const void *key, size_t len);
+/* NULL with *len = 0 for an entry pointing outside the file */
+const void *tree_file_key(const struct tree_file *f, size_t i, size_t *len);
+void *tree_file_data(const struct tree_file *f, size_t i, size_t *len);
+/* call fn on each index with lo <= key <= hi in order until it returns
+   nonzero; returns that value, or 0 */
+int tree_file_range(const struct tree_file *f, const void *lo, size_t lolen,
+                    const void *hi, size_t hilen,
+                    int (*fn)(const struct tree_file *f, size_t i, void *ctx),
+                    void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
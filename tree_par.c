@@ -0,0 +1,272 @@
+#include "tree_par.h"
+
+#include <malloc.h>
+#include <pthread.h>
+
+struct par_task {
+    void (*fn)(struct par_task *task);
+    int done;
+    struct par_task *next;
+};
+
+struct par_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct par_task *head;
+    int stop;
+    int depth;
+    int nthreads;
+    pthread_t threads[];
+};
+
+static struct par_task *pool_pop(struct par_pool *p) {
+    struct par_task *task = p->head;
+    if (task)
+        p->head = task->next;
+    return task;
+}
+
+/* called and returns with p->lock held */
+static void task_run(struct par_pool *p, struct par_task *task) {
+    pthread_mutex_unlock(&p->lock);
+    task->fn(task);
+    pthread_mutex_lock(&p->lock);
+    task->done = 1;
+    pthread_cond_broadcast(&p->cond);
+}
+
+static void *pool_worker(void *arg) {
+    struct par_pool *p = arg;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        struct par_task *task = pool_pop(p);
+        if (task) {
+            task_run(p, task);
+        } else if (p->stop) {
+            break;
+        } else {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+struct par_pool *par_pool_create(int nthreads) {
+    struct par_pool *p;
+    int i;
+    assert(nthreads > 0);
+    p = malloc(sizeof(*p) + sizeof(pthread_t) * nthreads);
+    assert(p);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    p->head = NULL;
+    p->stop = 0;
+    p->nthreads = nthreads;
+    /* a few tasks per thread so uneven halves still keep everyone busy;
+       a single thread just runs the sequential code */
+    p->depth = 0;
+    if (nthreads > 1)
+        for (p->depth = 2; (1 << (p->depth - 2)) < nthreads; p->depth++)
+            ;
+    /* the calling thread works too */
+    for (i = 1; i < nthreads; i++)
+        pthread_create(&p->threads[i], NULL, pool_worker, p);
+    return p;
+}
+
+void par_pool_destroy(struct par_pool *p) {
+    int i;
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    for (i = 1; i < p->nthreads; i++)
+        pthread_join(p->threads[i], NULL);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+}
+
+static void par_spawn(struct par_pool *p, struct par_task *task) {
+    task->done = 0;
+    pthread_mutex_lock(&p->lock);
+    task->next = p->head;
+    p->head = task;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* wait for task: run it here if nobody took it, else help with others */
+static void par_sync(struct par_pool *p, struct par_task *task) {
+    struct par_task **pp;
+    pthread_mutex_lock(&p->lock);
+    for (pp = &p->head; *pp && *pp != task; pp = &(*pp)->next)
+        ;
+    if (*pp) {
+        *pp = task->next;
+        task_run(p, task);
+    }
+    while (!task->done) {
+        struct par_task *other = pool_pop(p);
+        if (other)
+            task_run(p, other);
+        else
+            pthread_cond_wait(&p->cond, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+enum set_op {
+    OP_UNION, OP_INTERSECTION, OP_DIFFERENCE
+};
+
+struct set_task {
+    struct par_task task;
+    struct par_pool *p;
+    enum set_op op;
+    struct tree *a, *b;
+    tree_drop_fn drop;
+    void *ctx;
+    int depth;
+};
+
+static void set_op_run(struct par_pool *p, enum set_op op, struct tree *a,
+                       struct tree *b, tree_drop_fn drop, void *ctx, int depth);
+
+static void set_task_fn(struct par_task *task) {
+    struct set_task *st = (struct set_task *)task;
+    set_op_run(st->p, st->op, st->a, st->b, st->drop, st->ctx, st->depth);
+}
+
+/* join without a pivot: borrow the maximum of l */
+static void join2(struct tree *l, struct tree *r) {
+    struct tree_node *k;
+    if (r->root == t_nil)
+        return;
+    if (l->root == t_nil) {
+        l->root = r->root;
+        r->root = t_nil;
+        return;
+    }
+    k = tree_max(l, l->root);
+    tree_delete(l, k);
+    tree_join(l, k, r);
+}
+
+/* the recursion of tree_union & co, forking the two halves near the top */
+static void set_op_run(struct par_pool *p, enum set_op op, struct tree *a,
+                       struct tree *b, tree_drop_fn drop, void *ctx, int depth) {
+    struct tree al, ar, bl, br;
+    struct tree_node *k, *m;
+    struct set_task right;
+
+    if (depth <= 0 || a->root == t_nil || b->root == t_nil) {
+        if (op == OP_UNION)
+            tree_union(a, b, drop, ctx);
+        else if (op == OP_INTERSECTION)
+            tree_intersection(a, b, drop, ctx);
+        else
+            tree_difference(a, b, drop, ctx);
+        return;
+    }
+
+    /* splitting a by its own root key just detaches the two subtrees */
+    k = tree_split(a, a->root->key, &al, &ar);
+    m = tree_split(b, k->key, &bl, &br);
+
+    right.task.fn = set_task_fn;
+    right.p = p;
+    right.op = op;
+    right.a = &ar;
+    right.b = &br;
+    right.drop = drop;
+    right.ctx = ctx;
+    right.depth = depth - 1;
+    par_spawn(p, &right.task);
+    set_op_run(p, op, &al, &bl, drop, ctx, depth - 1);
+    par_sync(p, &right.task);
+
+    if (m != t_nil && drop)
+        drop(m, ctx);
+    if (op == OP_UNION || (op == OP_INTERSECTION && m != t_nil)) {
+        tree_join(&al, k, &ar);
+    } else if (op == OP_DIFFERENCE && m == t_nil) {
+        tree_join(&al, k, &ar);
+    } else {
+        if (drop)
+            drop(k, ctx);
+        join2(&al, &ar);
+    }
+    a->root = al.root;
+}
+
+void tree_par_union(struct par_pool *p, struct tree *t1, struct tree *t2,
+                    tree_drop_fn drop, void *ctx) {
+    assert(p);
+    set_op_run(p, OP_UNION, t1, t2, drop, ctx, p->depth);
+    t2->root = t_nil;
+}
+
+void tree_par_intersection(struct par_pool *p, struct tree *t1, struct tree *t2,
+                           tree_drop_fn drop, void *ctx) {
+    assert(p);
+    set_op_run(p, OP_INTERSECTION, t1, t2, drop, ctx, p->depth);
+    t2->root = t_nil;
+}
+
+void tree_par_difference(struct par_pool *p, struct tree *t1, struct tree *t2,
+                         tree_drop_fn drop, void *ctx) {
+    assert(p);
+    set_op_run(p, OP_DIFFERENCE, t1, t2, drop, ctx, p->depth);
+    t2->root = t_nil;
+}
+
+struct build_task {
+    struct par_task task;
+    struct par_pool *p;
+    struct tree *t;
+    struct tree_node **nodes;
+    size_t n;
+    int depth;
+};
+
+static void build_run(struct par_pool *p, struct tree *t, struct tree_node **nodes,
+                      size_t n, int depth);
+
+static void build_task_fn(struct par_task *task) {
+    struct build_task *bt = (struct build_task *)task;
+    build_run(bt->p, bt->t, bt->nodes, bt->n, bt->depth);
+}
+
+/* build both halves in parallel, then join them around the middle node */
+static void build_run(struct par_pool *p, struct tree *t, struct tree_node **nodes,
+                      size_t n, int depth) {
+    struct tree right;
+    struct build_task bt;
+    size_t mid = n / 2;
+
+    if (depth <= 0 || n < 2) {
+        tree_build_sorted(t, nodes, n);
+        return;
+    }
+    right = *t;
+    bt.task.fn = build_task_fn;
+    bt.p = p;
+    bt.t = &right;
+    bt.nodes = nodes + mid + 1;
+    bt.n = n - mid - 1;
+    bt.depth = depth - 1;
+    par_spawn(p, &bt.task);
+    build_run(p, t, nodes, mid, depth - 1);
+    par_sync(p, &bt.task);
+    tree_join(t, nodes[mid], &right);
+}
+
+void tree_par_build_sorted(struct par_pool *p, struct tree *t,
+                           struct tree_node **nodes, size_t n) {
+    assert(p);
+    assert(t);
+    assert(t->root == t_nil);
+    build_run(p, t, nodes, n, p->depth);
+}
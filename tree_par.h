@@ -0,0 +1,34 @@
+#ifndef TREE_PAR_H
+#define TREE_PAR_H
+
+#include "trees.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fork-join versions of the bulk operations. The top levels of the
+ * split/join recursion run as tasks on a small pool of worker threads;
+ * below the cut-off each task falls back to the sequential code in trees.c.
+ * drop callbacks may run on several threads at once.
+ */
+struct par_pool;
+
+struct par_pool *par_pool_create(int nthreads);
+void par_pool_destroy(struct par_pool *p);
+
+void tree_par_union(struct par_pool *p, struct tree *t1, struct tree *t2,
+                    tree_drop_fn drop, void *ctx);
+void tree_par_intersection(struct par_pool *p, struct tree *t1, struct tree *t2,
+                           tree_drop_fn drop, void *ctx);
+void tree_par_difference(struct par_pool *p, struct tree *t1, struct tree *t2,
+                         tree_drop_fn drop, void *ctx);
+void tree_par_build_sorted(struct par_pool *p, struct tree *t,
+                           struct tree_node **nodes, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+#include "tree_rw.h"
+
+#include <sched.h>
+
+/* pairs with SET_LINK in trees.c, which release_links turns into release
+   stores: a node reached through a link is seen with its key and links as
+   they were when it was linked */
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+/* how often a lookup checks whether a writer has been at the tree */
+#define RW_CHECK_STEPS 32
+
+void tree_rw_init(struct tree_rw *rw, const struct tree *t) {
+    assert(rw);
+    assert(t);
+    assert(t->type != T_BTREE);
+    rw->t = *t;
+    rw->t.release_links = 1;
+    rw->seq = 0;
+    rw->epoch = 1;
+    rw->readers = NULL;
+    pthread_mutex_init(&rw->lock, NULL);
+    pthread_mutex_init(&rw->readers_lock, NULL);
+}
+
+void tree_rw_destroy(struct tree_rw *rw) {
+    assert(!rw->readers);
+    pthread_mutex_destroy(&rw->lock);
+    pthread_mutex_destroy(&rw->readers_lock);
+}
+
+void tree_rw_reader_register(struct tree_rw *rw, struct tree_rw_reader *r) {
+    r->epoch = 0;
+    pthread_mutex_lock(&rw->readers_lock);
+    r->next = rw->readers;
+    rw->readers = r;
+    pthread_mutex_unlock(&rw->readers_lock);
+}
+
+void tree_rw_reader_unregister(struct tree_rw *rw, struct tree_rw_reader *r) {
+    struct tree_rw_reader **pp;
+    pthread_mutex_lock(&rw->readers_lock);
+    for (pp = &rw->readers; *pp != r; pp = &(*pp)->next)
+        ;
+    *pp = r->next;
+    pthread_mutex_unlock(&rw->readers_lock);
+}
+
+void tree_rw_read_begin(struct tree_rw *rw, struct tree_rw_reader *r) {
+    __atomic_store_n(&r->epoch, __atomic_load_n(&rw->epoch, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    /* publish the epoch before touching any node */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void tree_rw_read_end(struct tree_rw_reader *r) {
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Exact match (bound == 0) or first key >= key (bound != 0). The walk may
+ * see a tree in the middle of a rotation, so it checks the sequence count
+ * every few steps (a half-rotated tree can loop) and once at the end, and
+ * starts over if a writer got in. Links are read with acquire against
+ * the release stores trees.c links with, so the comparator is never
+ * handed a half-initialised node.
+ */
+static struct tree_node *rw_walk(struct tree_rw *rw, void *key, int bound) {
+    struct tree *t = &rw->t;
+    for (;;) {
+        unsigned long seq = __atomic_load_n(&rw->seq, __ATOMIC_ACQUIRE);
+        struct tree_node *x, *r = t_nil;
+        int steps = 0;
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        x = LOAD(t->root);
+        while (x != t_nil) {
+            int c = tree_key_cmp(t, key, LOAD(x->key));
+            if (c == 0 && !bound) {
+                r = x;
+                break;
+            }
+            if (c <= 0) {
+                r = x;
+                x = LOAD(x->left);
+            } else {
+                x = LOAD(x->right);
+            }
+            if (++steps % RW_CHECK_STEPS == 0 &&
+                __atomic_load_n(&rw->seq, __ATOMIC_ACQUIRE) != seq)
+                break;
+        }
+        if (!bound && x == t_nil)
+            r = t_nil;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&rw->seq, __ATOMIC_RELAXED) == seq)
+            return r;
+    }
+}
+
+struct tree_node *tree_rw_search(struct tree_rw *rw, void *key) {
+    assert(rw);
+    return rw_walk(rw, key, 0);
+}
+
+struct tree_node *tree_rw_lower_bound(struct tree_rw *rw, void *key) {
+    assert(rw);
+    return rw_walk(rw, key, 1);
+}
+
+static void write_begin(struct tree_rw *rw) {
+    pthread_mutex_lock(&rw->lock);
+    __atomic_store_n(&rw->seq, rw->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end(struct tree_rw *rw) {
+    __atomic_store_n(&rw->seq, rw->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rw->lock);
+}
+
+struct tree_node *tree_rw_insert(struct tree_rw *rw, struct tree_node *z) {
+    struct tree_node *r;
+    assert(rw);
+    write_begin(rw);
+    r = tree_insert(&rw->t, z);
+    write_end(rw);
+    return r;
+}
+
+void tree_rw_delete(struct tree_rw *rw, struct tree_node *z) {
+    assert(rw);
+    write_begin(rw);
+    tree_delete(&rw->t, z);
+    write_end(rw);
+}
+
+void tree_rw_synchronize(struct tree_rw *rw) {
+    struct tree_rw_reader *r;
+    unsigned long e;
+    e = __atomic_add_fetch(&rw->epoch, 1, __ATOMIC_SEQ_CST);
+    /* only the reader list is held while waiting, so writers go on */
+    pthread_mutex_lock(&rw->readers_lock);
+    for (r = rw->readers; r; r = r->next) {
+        unsigned long v;
+        while ((v = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE)) && v < e)
+            sched_yield();
+    }
+    pthread_mutex_unlock(&rw->readers_lock);
+}
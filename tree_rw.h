@@ -0,0 +1,64 @@
+#ifndef TREE_RW_H
+#define TREE_RW_H
+
+#include <pthread.h>
+
+#include "trees.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A binary tree (T_BST, T_RB, T_AVL or T_TREAP) shared by one writer at a
+ * time and any number of readers.
+ *
+ * Writers are serialised by a mutex and bump a sequence count around each
+ * change; tree_rw_synchronize does not take that mutex, so a writer is not
+ * held up while it waits. Readers never block and never write shared memory: a lookup walks
+ * the tree optimistically and retries if the count moved underneath it.
+ *
+ * Memory is reclaimed RCU-style. Each reader thread registers a
+ * tree_rw_reader and brackets lookups with tree_rw_read_begin/end. Nodes
+ * returned inside that bracket stay readable until tree_rw_read_end. A node
+ * taken out with tree_rw_delete may be freed or reused once
+ * tree_rw_synchronize has returned.
+ */
+struct tree_rw_reader {
+    /* epoch seen at tree_rw_read_begin, 0 outside a read section */
+    unsigned long epoch __attribute__((aligned(64)));
+    struct tree_rw_reader *next;
+};
+
+struct tree_rw {
+    struct tree t;
+    unsigned long seq;      /* odd while a writer is changing t */
+    unsigned long epoch;
+    struct tree_rw_reader *readers;
+    pthread_mutex_t lock;           /* writers */
+    pthread_mutex_t readers_lock;   /* the readers list */
+};
+
+/* take over t (settings and any nodes already in it) */
+void tree_rw_init(struct tree_rw *rw, const struct tree *t);
+void tree_rw_destroy(struct tree_rw *rw);
+
+void tree_rw_reader_register(struct tree_rw *rw, struct tree_rw_reader *r);
+void tree_rw_reader_unregister(struct tree_rw *rw, struct tree_rw_reader *r);
+void tree_rw_read_begin(struct tree_rw *rw, struct tree_rw_reader *r);
+void tree_rw_read_end(struct tree_rw_reader *r);
+
+/* call between tree_rw_read_begin and tree_rw_read_end */
+struct tree_node *tree_rw_search(struct tree_rw *rw, void *key);
+struct tree_node *tree_rw_lower_bound(struct tree_rw *rw, void *key);
+
+struct tree_node *tree_rw_insert(struct tree_rw *rw, struct tree_node *z);
+void tree_rw_delete(struct tree_rw *rw, struct tree_node *z);
+/* wait until every read section that was open when called has ended */
+void tree_rw_synchronize(struct tree_rw *rw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
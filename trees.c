@@ -2,46 +2,189 @@
 
 #include <malloc.h>
 
-struct tree_node t_null_node = {NULL, NULL, NULL, {BLACK}, NULL, NULL};
-struct tree_node *t_nil = &t_null_node;
+/*
+ * The sentinel is shared by every tree, so nothing may ever write to it:
+ * it lives in read-only memory and each write path below checks for it.
+ * That lets unrelated trees be mutated from different threads without
+ * any process-wide lock.
+ */
+const struct tree_node_aug t_null_node = {{NULL, NULL, NULL, {BLACK}, NULL, NULL}, 0, 0};
+struct tree_node *const t_nil = (struct tree_node *)&t_null_node.node;
+
+#ifdef TREE_STATS
+__thread struct tree_stats tree_stats;
+#endif
 
 #define T_KEY_LT(less, k1, k2) less(k1, k2)
-#define T_KEY_EQ(less, k1, k2) !(less(k1, k2) || less(k2, k1))
+
+/*
+ * Child and root links on the insert, delete and rotate paths. A tree with
+ * release_links set (tree_rw's) stores them with release semantics, so its
+ * readers, which load them with acquire, always find a node's key and
+ * links initialised; every other tree keeps plain stores.
+ */
+#define SET_LINK(t, link, x) do {                              \
+        if ((t)->release_links)                                 \
+            __atomic_store_n(&(link), (x), __ATOMIC_RELEASE);   \
+        else                                                    \
+            (link) = (x);                                       \
+    } while (0)
 
 static int max(int a, int b) {
     return a > b ? a : b;
 }
 
+/* the tree keeps per-subtree fields that rotations and relinks must redo */
+static inline int tree_augmented(struct tree *t) {
+    return t->order_stat || t->agg_combine;
+}
+
+static void agg_pull(struct tree *t, struct tree_node *x) {
+    long a = t->agg_value(x);
+    if (x->left != t_nil)
+        a = t->agg_combine(tree_aug(x->left)->agg, a);
+    if (x->right != t_nil)
+        a = t->agg_combine(a, tree_aug(x->right)->agg);
+    tree_aug(x)->agg = a;
+}
+
+/* recompute the subtree size and aggregate of x from its children */
+static inline void tree_pull(struct tree *t, struct tree_node *x) {
+    if (t->order_stat)
+        tree_aug(x)->size = tree_aug(x->left)->size + tree_aug(x->right)->size + 1;
+    if (t->agg_combine)
+        agg_pull(t, x);
+}
+
+/* ... for x and every ancestor of x */
+static void tree_pull_path(struct tree *t, struct tree_node *x) {
+    if (!tree_augmented(t))
+        return;
+    for (; x != t_nil; x = x->p)
+        tree_pull(t, x);
+}
+
 struct tree_node *tree_search(struct tree *t, void *key) {
     assert(t);
+    if (t->type == T_BTREE)
+        return btree_search(t, key);
     struct tree_node *x = t->root;
-    while (x != t_nil && !T_KEY_EQ(t->key_less, x->key, key))
-        if (T_KEY_LT(t->key_less, key, x->key))
-            x = x->left;
-        else
-            x = x->right;
+    while (x != t_nil) {
+        int c = tree_key_cmp(t, key, x->key);
+        TREE_STAT(visited);
+        if (c == 0)
+            break;
+        x = c < 0 ? x->left : x->right;
+    }
     return x;
 }
 
+/*
+ * Lookups in flight at once in tree_search_batch. Each one waits on a cache
+ * miss per level; walking SEARCH_GROUP of them round-robin and prefetching
+ * the next node of each lets those misses overlap.
+ */
+#define SEARCH_GROUP 16
+
+void tree_search_batch(struct tree *t, void **keys, size_t n, struct tree_node **out) {
+    struct tree_node *x[SEARCH_GROUP];
+    size_t idx[SEARCH_GROUP], next = 0;
+    /* set once x[i]->key has been prefetched, for keys behind a pointer */
+    char ready[SEARCH_GROUP];
+    int i, live = 0;
+    assert(t);
+    if (t->type == T_BTREE) {
+        for (; next < n; next++)
+            out[next] = btree_search(t, keys[next]);
+        return;
+    }
+    for (; live < SEARCH_GROUP && next < n; live++) {
+        x[live] = t->root;
+        idx[live] = next++;
+        ready[live] = t->int_keys;
+    }
+    while (live) {
+        for (i = 0; i < live; i++) {
+            struct tree_node *y = x[i];
+            int c;
+            if (y != t_nil && !ready[i]) {
+                __builtin_prefetch(y->key);
+                ready[i] = 1;
+                continue;
+            }
+            if (y != t_nil && (c = tree_key_cmp(t, keys[idx[i]], y->key)) != 0) {
+                TREE_STAT(visited);
+                y = c < 0 ? y->left : y->right;
+                __builtin_prefetch(y);
+                x[i] = y;
+                ready[i] = t->int_keys;
+                continue;
+            }
+            if (y != t_nil)
+                TREE_STAT(visited);
+            out[idx[i]] = y;
+            /* start the next key in this slot, or close the gap */
+            if (next < n) {
+                x[i] = t->root;
+                idx[i] = next++;
+                ready[i] = t->int_keys;
+            } else {
+                live--;
+                x[i] = x[live];
+                idx[i] = idx[live];
+                ready[i] = ready[live];
+                i--;
+            }
+        }
+    }
+}
+
+/* next node after x in a pre-order walk of subtree r, tracking the depth */
+static struct tree_node *preorder_next(struct tree_node *r, struct tree_node *x, int *depth) {
+    if (x->left != t_nil) {
+        (*depth)++;
+        return x->left;
+    }
+    if (x->right != t_nil) {
+        (*depth)++;
+        return x->right;
+    }
+    while (x != r) {
+        struct tree_node *p = x->p;
+        if (x == p->left && p->right != t_nil)
+            return p->right;
+        x = p;
+        (*depth)--;
+    }
+    return t_nil;
+}
+
+/* pre-order, without recursion so degenerate trees cannot blow the stack */
 void tree_travel(struct tree *t, struct tree_node *r, void(*fn)(struct tree_node *n)) {
-    if (r == t_nil)
+    struct tree_node *x;
+    int depth = 0;
+    if (t && t->type == T_BTREE) {
+        btree_travel(t, fn);
         return;
-    fn(r);
-    tree_travel(t, r->left, fn);
-    tree_travel(t, r->right, fn);
+    }
+    for (x = r; x != t_nil; x = preorder_next(r, x, &depth))
+        fn(x);
 }
 
 int tree_height(struct tree *t, struct tree_node *x) {
-    if (x == t_nil) {
-        return 0;
-    }
-    int l = tree_height(t, x->left);
-    int r = tree_height(t, x->right);
-    return max(l, r) + 1;
+    struct tree_node *y;
+    int depth = 1, h = 0;
+    if (t && t->type == T_BTREE)
+        return btree_height(t);
+    for (y = x; y != t_nil; y = preorder_next(x, y, &depth))
+        h = max(h, depth);
+    return h;
 }
 
 struct tree_node *tree_min(struct tree *t, struct tree_node *r) {
     struct tree_node *x = r;
+    if (t && t->type == T_BTREE)
+        return btree_min(t);
     if (x == t_nil) {
         return x;
     }
@@ -53,6 +196,8 @@ struct tree_node *tree_min(struct tree *t, struct tree_node *r) {
 
 struct tree_node *tree_max(struct tree *t, struct tree_node *r) {
     struct tree_node *x = r;
+    if (t && t->type == T_BTREE)
+        return btree_max(t);
     if (x == t_nil) {
         return x;
     }
@@ -65,6 +210,8 @@ struct tree_node *tree_max(struct tree *t, struct tree_node *r) {
 struct tree_node *tree_successor(struct tree *t, struct tree_node *x) {
     assert(t);
     assert(x);
+    if (t->type == T_BTREE)
+        return btree_successor(t, x);
     struct tree_node *y = x->p;
     if (x->right != t_nil)
         return tree_min(t, x->right);
@@ -78,6 +225,8 @@ struct tree_node *tree_successor(struct tree *t, struct tree_node *x) {
 struct tree_node *tree_predecessor(struct tree *t, struct tree_node *x) {
     assert(t);
     assert(x);
+    if (t->type == T_BTREE)
+        return btree_predecessor(t, x);
 
     struct tree_node *y = x->p;
     if (x->left != t_nil)
@@ -98,18 +247,21 @@ struct tree_node *tree_predecessor(struct tree *t, struct tree_node *x) {
 */
 void bst_right_rotate(struct tree *t, struct tree_node *x) {
     struct tree_node *y = x->left;
-    x->left = y->right;
+    TREE_STAT(rotations);
+    SET_LINK(t, x->left, y->right);
     if (y->right != t_nil)
         y->right->p = x;
     y->p = x->p;
     if (x->p == t_nil)
-        t->root = y;
+        SET_LINK(t, t->root, y);
     else if (x == x->p->right)
-        x->p->right = y;
+        SET_LINK(t, x->p->right, y);
     else
-        x->p->left = y;
-    y->right = x;
+        SET_LINK(t, x->p->left, y);
+    SET_LINK(t, y->right, x);
     x->p = y;
+    tree_pull(t, x);
+    tree_pull(t, y);
 }
 
 /*
@@ -121,29 +273,47 @@ void bst_right_rotate(struct tree *t, struct tree_node *x) {
 */
 void bst_left_rotate(struct tree *t, struct tree_node *x) {
     struct tree_node *y = x->right;
-    x->right = y->left;
+    TREE_STAT(rotations);
+    SET_LINK(t, x->right, y->left);
     if (y->left != t_nil)
         y->left->p = x;
     y->p = x->p;
     if (x->p == t_nil)
-        t->root = y;
+        SET_LINK(t, t->root, y);
     else if (x == x->p->left)
-        x->p->left = y;
+        SET_LINK(t, x->p->left, y);
     else
-        x->p->right = y;
-    y->left = x;
+        SET_LINK(t, x->p->right, y);
+    SET_LINK(t, y->left, x);
     x->p = y;
+    tree_pull(t, x);
+    tree_pull(t, y);
 }
 
 /* replace u with v */
 static void bst_transplant(struct tree *t, struct tree_node *u, struct tree_node *v) {
     if (u->p == t_nil)
-        t->root = v;
+        SET_LINK(t, t->root, v);
     else if (u == u->p->left)
-        u->p->left = v;
+        SET_LINK(t, u->p->left, v);
     else
-        u->p->right = v;
-    v->p = u->p;
+        SET_LINK(t, u->p->right, v);
+    if (v != t_nil)
+        v->p = u->p;
+}
+
+/* hang leaf z under p (the root if p is t_nil), on the left if left != 0 */
+void bst_link(struct tree *t, struct tree_node *p, struct tree_node *z, int left) {
+    z->p = p;
+    z->left = t_nil;
+    z->right = t_nil;
+    if (p == t_nil)
+        SET_LINK(t, t->root, z);
+    else if (left)
+        SET_LINK(t, p->left, z);
+    else
+        SET_LINK(t, p->right, z);
+    tree_pull_path(t, z);
 }
 
 struct tree_node *bst_insert(struct tree *t, struct tree_node *z) {
@@ -151,50 +321,58 @@ struct tree_node *bst_insert(struct tree *t, struct tree_node *z) {
     assert(z);
     struct tree_node *y = t_nil;
     struct tree_node *x = t->root;
+    int c = 0;
     while (x != t_nil) {
         y = x;
-        if (T_KEY_LT(t->key_less, z->key, x->key))
+        c = tree_key_cmp(t, z->key, x->key);
+        TREE_STAT(visited);
+        if (c < 0)
             x = x->left;
-        else if (T_KEY_LT(t->key_less, x->key, z->key))
+        else if (c > 0)
             x = x->right;
         else
             return x;
     }
-    z->p = y;
-    if (y == t_nil)
-        t->root = z;
-    else if (T_KEY_LT(t->key_less, z->key, y->key))
-        y->left = z;
-    else
-        y->right = z;
-    z->left = t_nil;
-    z->right = t_nil;
+    bst_link(t, y, z, c < 0);
     return z;
 }
 
-void bst_delete(struct tree *t, struct tree_node *z) {
-    assert(t);
-    assert(z);
+/* unlink z, splicing in its successor if needed; returns the lowest node
+   whose subtree changed */
+static struct tree_node *bst_remove(struct tree *t, struct tree_node *z) {
+    struct tree_node *from = z->p;
     if (z->left == t_nil) {
         bst_transplant(t, z, z->right);
     } else if (z->right == t_nil) {
         bst_transplant(t, z, z->left);
     } else {
         struct tree_node *y = tree_min(t, z->right);
+        from = y;
         if (y->p != z) {
+            from = y->p;
             bst_transplant(t, y, y->right);
-            y->right = z->right;
+            SET_LINK(t, y->right, z->right);
             y->right->p = y;
         }
         bst_transplant(t, z, y);
-        y->left = z->left;
+        SET_LINK(t, y->left, z->left);
         z->left->p = y;
     }
+    return from;
+}
+
+void bst_delete(struct tree *t, struct tree_node *z) {
+    assert(t);
+    assert(z);
+    tree_pull_path(t, bst_remove(t, z));
 }
 
-static void rb_insert_fixup(struct tree *t, struct tree_node *z) {
+/* returns 1 if the black height of the tree grew */
+int rb_insert_fixup(struct tree *t, struct tree_node *z) {
     struct tree_node *y = t_nil;
+    z->fea.color = RED;
     while (z->p->fea.color == RED) {
+        TREE_STAT(fixups);
         if (z->p == z->p->p->left) {
             // parent is left
             y = z->p->p->right; // y is uncle
@@ -264,18 +442,22 @@ static void rb_insert_fixup(struct tree *t, struct tree_node *z) {
             break;
         }
     }
+    int grew = t->root->fea.color == RED;
     t->root->fea.color = BLACK;
+    return grew;
 }
 
 static void rb_tree_transplant(struct tree *t, struct tree_node *u, struct tree_node *v) {
     bst_transplant(t, u, v);
 }
 
-static void rb_tree_delete_fixup(struct tree *t, struct tree_node *x) {
+/* x may be the sentinel, so its parent is tracked in xp instead of x->p */
+static void rb_tree_delete_fixup(struct tree *t, struct tree_node *x, struct tree_node *xp) {
     struct tree_node *w;
     while (x != t->root && x->fea.color == BLACK) {
-        if (x == x->p->left) {
-            w = x->p->right;
+        TREE_STAT(fixups);
+        if (x == xp->left) {
+            w = xp->right;
             if (w->fea.color == RED) {
                 /*
                     case 1 - brother is red (left rotate parent)
@@ -286,9 +468,9 @@ static void rb_tree_delete_fixup(struct tree *t, struct tree_node *x) {
                         Xl   Xr   *X  ^Wl
                 */
                 w->fea.color = BLACK;
-                x->p->fea.color = RED;
-                bst_left_rotate(t, x->p);
-                w = x->p->right;
+                xp->fea.color = RED;
+                bst_left_rotate(t, xp);
+                w = xp->right;
                 continue;
             }
             if (w->left->fea.color == BLACK && w->right->fea.color == BLACK) {
@@ -302,7 +484,8 @@ static void rb_tree_delete_fixup(struct tree *t, struct tree_node *x) {
                          Wl  Wr         Wl  Wr
                 */
                 w->fea.color = RED;
-                x = x->p;
+                x = xp;
+                xp = x->p;
                 continue;
             } else if (w->right->fea.color == BLACK) {
                 /*
@@ -320,7 +503,7 @@ static void rb_tree_delete_fixup(struct tree *t, struct tree_node *x) {
                w->left->fea.color = BLACK;
                w->fea.color = RED;
                bst_right_rotate(t, w);
-               w = x->p->right;
+               w = xp->right;
             }
             /*
                 case 4 - brother is BLACK, brother->right is red
@@ -333,44 +516,47 @@ static void rb_tree_delete_fixup(struct tree *t, struct tree_node *x) {
                       / \       / \
                     (wl) wr    X  (wl)
             */
-            w->fea.color = x->p->fea.color;
-            x->p->fea.color = BLACK;
+            w->fea.color = xp->fea.color;
+            xp->fea.color = BLACK;
             w->right->fea.color = BLACK;
-            bst_left_rotate(t, x->p);
+            bst_left_rotate(t, xp);
             x = t->root;
         } else {
-            w = x->p->left;
+            w = xp->left;
             if (w->fea.color == RED) {
                 w->fea.color = BLACK;
-                x->p->fea.color = RED;
-                bst_right_rotate(t, x->p);
-                w = x->p->left;
+                xp->fea.color = RED;
+                bst_right_rotate(t, xp);
+                w = xp->left;
                 continue;
             }
             if (w->right->fea.color == BLACK && w->left->fea.color == BLACK) {
                 w->fea.color = RED;
-                x = x->p;
+                x = xp;
+                xp = x->p;
                 continue;
             } else if (w->left->fea.color == BLACK) {
                w->right->fea.color = BLACK;
                w->fea.color = RED;
                bst_left_rotate(t, w);
-               w = x->p->left;
+               w = xp->left;
             }
-            w->fea.color = x->p->fea.color;
-            x->p->fea.color = BLACK;
+            w->fea.color = xp->fea.color;
+            xp->fea.color = BLACK;
             w->left->fea.color = BLACK;
-            bst_right_rotate(t, x->p);
+            bst_right_rotate(t, xp);
             x = t->root;
         }
     }
-    x->fea.color = BLACK;
+    if (x != t_nil)
+        x->fea.color = BLACK;
 }
 
 void rb_tree_delete(struct tree *t, struct tree_node *z) {
     assert(t);
     assert(z);
     struct tree_node *x = t_nil;
+    struct tree_node *xp = z->p;
     struct tree_node *y = z;
     enum rb_color y_origin_color = y->fea.color;
     if (z->left == t_nil) {
@@ -384,32 +570,34 @@ void rb_tree_delete(struct tree *t, struct tree_node *z) {
         y_origin_color = y->fea.color;
         x = y->right;
         if (y->p == z) {
-            x->p = y;
+            xp = y;
         } else {
+            xp = y->p;
             rb_tree_transplant(t, y, y->right);
-            y->right = z->right;
+            SET_LINK(t, y->right, z->right);
             y->right->p = y;
         }
         rb_tree_transplant(t, z, y);
-        y->left = z->left;
+        SET_LINK(t, y->left, z->left);
         y->left->p = y;
         y->fea.color = z->fea.color;
     }
+    tree_pull_path(t, xp);
     if (y_origin_color == BLACK)
-        rb_tree_delete_fixup(t, x);
+        rb_tree_delete_fixup(t, x, xp);
 }
 
 struct tree_node *rb_tree_insert(struct tree *t, struct tree_node *z) {
     struct tree_node *zz = bst_insert(t, z);
     if (zz != z)
         return zz;
-    z->fea.color = RED;
     rb_insert_fixup(t, z);
     return z;
 }
 
-static void treap_balance_up(struct tree *t, struct tree_node *z) {
+void treap_insert_fixup(struct tree *t, struct tree_node *z) {
     while (z != t->root && T_KEY_LT(t->priority_less, z->p->fea.priority, z->fea.priority)) {
+        TREE_STAT(fixups);
         if (z->p->left == z) {
             bst_right_rotate(t, z->p);
         } else {
@@ -437,35 +625,23 @@ struct tree_node *treap_insert(struct tree *t, struct tree_node *z) {
     struct tree_node *zz = bst_insert(t, z);
     if (zz != z)
         return zz;
-    treap_balance_up(t, z);
+    treap_insert_fixup(t, z);
     return z;
 }
 
 void treap_delete(struct tree *t, struct tree_node *z) {
     assert(t);
     assert(z);
-    while (z->left != t_nil || z->right != t_nil) {
-        if (z->left == t_nil) {
-            bst_transplant(t, z, z->right);
-            return;
-        }
-        if (z->right == t_nil) {
-            bst_transplant(t, z, z->left);
-            return;
-        }
-
+    /* rotate the higher priority child up until z has at most one child */
+    while (z->left != t_nil && z->right != t_nil) {
+        TREE_STAT(fixups);
         if (treap_pri_less(t, z->left, z->right))
-            bst_right_rotate(t, z);
-        else 
             bst_left_rotate(t, z);
-
+        else
+            bst_right_rotate(t, z);
     }
-    if (z == t->root)
-        t->root = t_nil;
-    else if (z->p->left == z)
-        z->p->left = t_nil;
-    else
-        z->p->right = t_nil;
+    bst_transplant(t, z, z->left == t_nil ? z->right : z->left);
+    tree_pull_path(t, z->p);
 }
 
 static void update_height(struct tree_node *x) {
@@ -547,8 +723,10 @@ static void avl_rebalance(struct tree *t, struct tree_node *x, struct tree_node
 
 void avl_insert_fixup(struct tree *t, struct tree_node *w) {
     struct tree_node *x, *y, *z;
+    w->fea.height = 1;
     x = y = z = w;
     while (z != t_nil && y != t->root) {
+        TREE_STAT(fixups);
         update_height(z);
         if (!avl_is_balance(z))
             avl_rebalance(t, x, y, z);
@@ -561,7 +739,6 @@ void avl_insert_fixup(struct tree *t, struct tree_node *w) {
 struct tree_node *avl_insert(struct tree *t, struct tree_node *z) {
     assert(t);
     assert(z);
-    z->fea.height = 1;
     struct tree_node *zz = bst_insert(t, z);
     if (zz != z)
         return zz;
@@ -569,9 +746,26 @@ struct tree_node *avl_insert(struct tree *t, struct tree_node *z) {
     return z;
 }
 
+static struct tree_node *avl_taller(struct tree_node *x, struct tree_node *prefer) {
+    if (x->left->fea.height > x->right->fea.height)
+        return x->left;
+    if (x->left->fea.height < x->right->fea.height)
+        return x->right;
+    return prefer;
+}
+
+/* walk from w to the root, fixing heights and rotating unbalanced nodes */
 static void avl_delete_fixup(struct tree *t, struct tree_node *w) {
     while (w != t_nil) {
+        TREE_STAT(fixups);
         update_height(w);
+        tree_pull(t, w);
+        if (!avl_is_balance(w)) {
+            struct tree_node *y = avl_taller(w, t_nil);
+            struct tree_node *x = avl_taller(y, y == w->left ? y->left : y->right);
+            avl_rebalance(t, x, y, w);
+            w = w->p;
+        }
         w = w->p;
     }
 }
@@ -579,19 +773,927 @@ static void avl_delete_fixup(struct tree *t, struct tree_node *w) {
 void avl_delete(struct tree *t, struct tree_node *z) {
     assert(t);
     assert(z);
-    while (z->left != t_nil || z->right != t_nil) {
-        if (z->left->fea.height < z->right->fea.height)
-            avl_left_rotate(t, z);
+    avl_delete_fixup(t, bst_remove(t, z));
+}
+
+struct tree_node *tree_select(struct tree *t, size_t k) {
+    assert(t);
+    assert(t->order_stat && t->type != T_BTREE);
+    struct tree_node *x = t->root;
+    while (x != t_nil) {
+        size_t ls = tree_aug(x->left)->size;
+        if (k < ls) {
+            x = x->left;
+        } else if (k == ls) {
+            break;
+        } else {
+            k -= ls + 1;
+            x = x->right;
+        }
+    }
+    return x;
+}
+
+size_t tree_rank(struct tree *t, void *key) {
+    assert(t);
+    assert(t->order_stat && t->type != T_BTREE);
+    struct tree_node *x = t->root;
+    size_t r = 0;
+    while (x != t_nil) {
+        int c = tree_key_cmp(t, key, x->key);
+        if (c < 0) {
+            x = x->left;
+        } else if (c == 0) {
+            r += tree_aug(x->left)->size;
+            break;
+        } else {
+            r += tree_aug(x->left)->size + 1;
+            x = x->right;
+        }
+    }
+    return r;
+}
+
+/*
+ * Descend to the topmost node inside [lo, hi]; below it the range is a
+ * suffix of its left subtree and a prefix of its right one. Each node on
+ * those two paths that falls inside adds itself and its whole inner
+ * subtree, so only O(height) nodes are visited.
+ */
+int tree_aggregate(struct tree *t, void *lo, void *hi, long *out) {
+    assert(t);
+    assert(t->agg_combine && t->type != T_BTREE);
+    struct tree_node *x = t->root, *y;
+    long a;
+    while (x != t_nil) {
+        if (tree_key_cmp(t, x->key, lo) < 0)
+            x = x->right;
+        else if (tree_key_cmp(t, x->key, hi) > 0)
+            x = x->left;
+        else
+            break;
+    }
+    if (x == t_nil)
+        return 0;
+    a = t->agg_value(x);
+    for (y = x->left; y != t_nil;) {
+        if (tree_key_cmp(t, y->key, lo) < 0) {
+            y = y->right;
+            continue;
+        }
+        if (y->right != t_nil)
+            a = t->agg_combine(tree_aug(y->right)->agg, a);
+        a = t->agg_combine(t->agg_value(y), a);
+        y = y->left;
+    }
+    for (y = x->right; y != t_nil;) {
+        if (tree_key_cmp(t, y->key, hi) > 0) {
+            y = y->left;
+            continue;
+        }
+        if (y->left != t_nil)
+            a = t->agg_combine(a, tree_aug(y->left)->agg);
+        a = t->agg_combine(a, t->agg_value(y));
+        y = y->right;
+    }
+    *out = a;
+    return 1;
+}
+
+void tree_update(struct tree *t, struct tree_node *x) {
+    assert(t);
+    assert(t->type != T_BTREE);
+    tree_pull_path(t, x);
+}
+
+/* pull sizes and aggregates bottom-up over the whole tree, without recursion */
+static void tree_pull_all(struct tree *t) {
+    struct tree_node *x = t->root, *prev = t_nil;
+    if (!tree_augmented(t))
+        return;
+    while (x != t_nil) {
+        if (prev == x->p && x->left != t_nil) {
+            prev = x;
+            x = x->left;
+        } else if ((prev == x->p || prev == x->left) && x->right != t_nil) {
+            prev = x;
+            x = x->right;
+        } else {
+            tree_pull(t, x);
+            prev = x;
+            x = x->p;
+        }
+    }
+}
+
+/*
+ * Link nodes[lo, hi) into a perfectly balanced subtree. Every level above
+ * red_depth is full, so colouring the partial last level red keeps the
+ * black height equal on all paths.
+ */
+static struct tree_node *build_balanced(struct tree *t, struct tree_node **nodes,
+                                        size_t lo, size_t hi, struct tree_node *p,
+                                        int depth, int red_depth) {
+    if (lo == hi)
+        return t_nil;
+    size_t mid = lo + (hi - lo) / 2;
+    struct tree_node *x = nodes[mid];
+    x->p = p;
+    x->left = build_balanced(t, nodes, lo, mid, x, depth + 1, red_depth);
+    x->right = build_balanced(t, nodes, mid + 1, hi, x, depth + 1, red_depth);
+    if (t->type == T_RB)
+        x->fea.color = depth == red_depth ? RED : BLACK;
+    else if (t->type == T_AVL)
+        update_height(x);
+    tree_pull(t, x);
+    return x;
+}
+
+/* Cartesian tree: keep the right spine on a stack threaded through p */
+static void build_treap(struct tree *t, struct tree_node **nodes, size_t n) {
+    struct tree_node *last = t_nil;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        struct tree_node *x = nodes[i], *y = last, *c = t_nil;
+        while (y != t_nil && treap_pri_less(t, y, x)) {
+            c = y;
+            y = y->p;
+        }
+        x->left = c;
+        if (c != t_nil)
+            c->p = x;
+        x->right = t_nil;
+        x->p = y;
+        if (y == t_nil)
+            t->root = x;
         else
-            avl_right_rotate(t, z);
+            y->right = x;
+        last = x;
     }
-    if (z == t->root) {
-        t->root = t_nil;
+    tree_pull_all(t);
+}
+
+void tree_build_sorted(struct tree *t, struct tree_node **nodes, size_t n) {
+    assert(t);
+    assert(t->root == t_nil);
+    if (t->type == T_BTREE) {
+        btree_build_sorted(t, nodes, n);
+        return;
+    }
+    if (t->type == T_TREAP) {
+        build_treap(t, nodes, n);
+        return;
+    }
+    int full = 0;
+    while (((size_t)2 << full) - 1 <= n)
+        full++;
+    t->root = build_balanced(t, nodes, 0, n, t_nil, 0, full);
+    if (t->root != t_nil && t->type == T_RB)
+        t->root->fea.color = BLACK;
+}
+
+/* first node with key >= key (upper == 0) or key > key (upper != 0) */
+static struct tree_node *tree_bound(struct tree *t, void *key, int upper) {
+    struct tree_node *x = t->root;
+    struct tree_node *r = t_nil;
+    while (x != t_nil) {
+        int c = tree_key_cmp(t, key, x->key);
+        TREE_STAT(visited);
+        if (c < 0 || (c == 0 && !upper)) {
+            r = x;
+            x = x->left;
+        } else {
+            x = x->right;
+        }
+    }
+    return r;
+}
+
+struct tree_node *tree_lower_bound(struct tree *t, void *key) {
+    assert(t);
+    if (t->type == T_BTREE)
+        return btree_bound(t, key, 0);
+    return tree_bound(t, key, 0);
+}
+
+struct tree_node *tree_upper_bound(struct tree *t, void *key) {
+    assert(t);
+    if (t->type == T_BTREE)
+        return btree_bound(t, key, 1);
+    return tree_bound(t, key, 1);
+}
+
+void tree_iter_init(struct tree_iter *it, struct tree *t, struct tree_node *x) {
+    assert(it);
+    assert(t);
+    it->t = t;
+    it->node = x;
+}
+
+struct tree_node *tree_iter_next(struct tree_iter *it) {
+    struct tree_node *x = it->node;
+    if (x != t_nil)
+        it->node = tree_successor(it->t, x);
+    return x;
+}
+
+struct tree_node *tree_iter_prev(struct tree_iter *it) {
+    struct tree_node *x = it->node;
+    if (x != t_nil)
+        it->node = tree_predecessor(it->t, x);
+    return x;
+}
+
+int tree_range(struct tree *t, void *lo, void *hi,
+               int (*fn)(struct tree_node *n, void *ctx), void *ctx) {
+    assert(t);
+    struct tree_node *x = tree_lower_bound(t, lo);
+    int r = 0;
+    while (x != t_nil && tree_key_cmp(t, x->key, hi) <= 0) {
+        struct tree_node *next = tree_successor(t, x);
+        r = fn(x, ctx);
+        if (r)
+            break;
+        x = next;
+    }
+    return r;
+}
+
+struct tree_node *tree_insert(struct tree *t, struct tree_node *z) {
+    assert(t);
+    switch (t->type) {
+        case T_RB:
+            return rb_tree_insert(t, z);
+        case T_AVL:
+            return avl_insert(t, z);
+        case T_TREAP:
+            return treap_insert(t, z);
+        case T_BTREE:
+            return btree_insert(t, z);
+        default:
+            return bst_insert(t, z);
+    }
+}
+
+void tree_delete(struct tree *t, struct tree_node *z) {
+    assert(t);
+    switch (t->type) {
+        case T_RB:
+            rb_tree_delete(t, z);
+            break;
+        case T_AVL:
+            avl_delete(t, z);
+            break;
+        case T_TREAP:
+            treap_delete(t, z);
+            break;
+        case T_BTREE:
+            btree_delete(t, z);
+            break;
+        default:
+            bst_delete(t, z);
+            break;
+    }
+}
+
+/*
+ * Finger search: climb from a node near the key until an ancestor bounds
+ * it, then descend. Say the key lies right of the finger. Climbing out of
+ * a right child changes nothing; the first ancestor the path enters from
+ * the left bounds everything below it from above. If its key is above ours
+ * too, the key belongs under start, the lowest node that bound covers, so
+ * the descent begins there; if not, that ancestor becomes start and the
+ * climb goes on. A climb that reaches the root unbounded (appends past the
+ * maximum) also descends from start. In a balanced tree both halves cost
+ * O(log d) for a key d places away. Returns the node to descend from, or
+ * the node holding key if the climb met it.
+ */
+static struct tree_node *finger_climb(struct tree *t, struct tree_node *x, void *key,
+                                      int *found) {
+    struct tree_node *start = x;
+    int c = tree_key_cmp(t, key, x->key);
+    *found = c == 0;
+    if (c == 0)
+        return x;
+    while (x->p != t_nil) {
+        struct tree_node *p = x->p;
+        if (c > 0 ? x == p->left : x == p->right) {
+            int pc = tree_key_cmp(t, key, p->key);
+            *found = pc == 0;
+            if (pc == 0)
+                return p;
+            if ((pc < 0) == (c > 0))
+                break;
+            start = p;
+        }
+        x = p;
+    }
+    return start;
+}
+
+struct tree_node *tree_search_from(struct tree *t, struct tree_node *finger, void *key) {
+    int found;
+    assert(t);
+    if (t->type == T_BTREE || finger == t_nil)
+        return tree_search(t, key);
+    struct tree_node *x = finger_climb(t, finger, key, &found);
+    if (found)
+        return x;
+    while (x != t_nil) {
+        int c = tree_key_cmp(t, key, x->key);
+        TREE_STAT(visited);
+        if (c == 0)
+            break;
+        x = c < 0 ? x->left : x->right;
+    }
+    return x;
+}
+
+/* hang the new leaf z under y and rebalance */
+static void insert_at(struct tree *t, struct tree_node *y, struct tree_node *z, int left) {
+    bst_link(t, y, z, left);
+    switch (t->type) {
+        case T_RB:
+            rb_insert_fixup(t, z);
+            break;
+        case T_AVL:
+            avl_insert_fixup(t, z);
+            break;
+        case T_TREAP:
+            treap_insert_fixup(t, z);
+            break;
+        default:
+            break;
+    }
+}
+
+struct tree_node *tree_insert_from(struct tree *t, struct tree_node *finger,
+                                   struct tree_node *z) {
+    struct tree_node *x, *y = t_nil;
+    int found, c = 0;
+    assert(t);
+    assert(z);
+    if (t->type == T_BTREE || finger == t_nil)
+        return tree_insert(t, z);
+    x = finger_climb(t, finger, z->key, &found);
+    if (found)
+        return x;
+    while (x != t_nil) {
+        y = x;
+        c = tree_key_cmp(t, z->key, x->key);
+        TREE_STAT(visited);
+        if (c == 0)
+            return x;
+        x = c < 0 ? x->left : x->right;
+    }
+    insert_at(t, y, z, c < 0);
+    return z;
+}
+
+/*
+ * Split and join work on detached subtrees ("pieces"). For T_RB a piece
+ * always has a black root and carries its black height, so joins cost
+ * O(difference in height) instead of a walk down the spine.
+ */
+struct piece {
+    struct tree_node *root;
+    int bh;
+};
+
+static int rb_black_height(struct tree_node *x) {
+    int h = 0;
+    for (; x != t_nil; x = x->left)
+        h += x->fea.color == BLACK;
+    return h;
+}
+
+/* detach x (black height bh) from its parent as a standalone piece */
+static struct piece piece_of(struct tree *t, struct tree_node *x, int bh) {
+    struct piece p = {x, bh};
+    if (x != t_nil) {
+        x->p = t_nil;
+        if (t->type == T_RB && x->fea.color == RED) {
+            x->fea.color = BLACK;
+            p.bh++;
+        }
+    }
+    return p;
+}
+
+static struct piece tree_piece(struct tree *t) {
+    return piece_of(t, t->root, t->type == T_RB ? rb_black_height(t->root) : 0);
+}
+
+/* black height of the children of p's (black) root */
+static int child_bh(struct tree *t, struct piece p) {
+    return t->type == T_RB ? p.bh - 1 : 0;
+}
+
+static void join_root(struct tree *s, struct tree_node *a, struct tree_node *k,
+                      struct tree_node *b) {
+    k->left = a;
+    k->right = b;
+    k->p = t_nil;
+    if (a != t_nil)
+        a->p = k;
+    if (b != t_nil)
+        b->p = k;
+    s->root = k;
+    tree_pull(s, k);
+}
+
+/*
+ * Hang k, with children a and b, as the left (left != 0) or right child of
+ * p inside the scratch tree s.
+ */
+static void join_hang(struct tree *s, struct tree_node *p, int left,
+                      struct tree_node *a, struct tree_node *k, struct tree_node *b) {
+    k->left = a;
+    k->right = b;
+    if (a != t_nil)
+        a->p = k;
+    if (b != t_nil)
+        b->p = k;
+    k->p = p;
+    if (left)
+        p->left = k;
+    else
+        p->right = k;
+    tree_pull(s, k);
+    tree_pull_path(s, p);
+}
+
+/*
+                 L (bh 3)                          L
+                /        \                        / \
+              ...        ...   + k + R (bh 1)   ...  ...
+                           \        -->                \
+                            y (bh 1)                    k (red)
+                                                       / \
+                                                      y   R
+   then the usual insert fixup from k.
+*/
+static struct piece rb_join(struct tree *s, struct piece l, struct tree_node *k,
+                            struct piece r) {
+    struct tree_node *y, *p = t_nil;
+    int h, grew;
+    if (l.bh == r.bh) {
+        join_root(s, l.root, k, r.root);
+        k->fea.color = BLACK;
+        l.root = k;
+        l.bh++;
+        return l;
+    }
+    if (l.bh > r.bh) {
+        s->root = y = l.root;
+        for (h = l.bh; !(y->fea.color == BLACK && h == r.bh); y = y->right) {
+            h -= y->fea.color == BLACK;
+            p = y;
+        }
+        join_hang(s, p, 0, y, k, r.root);
+    } else {
+        s->root = y = r.root;
+        for (h = r.bh; !(y->fea.color == BLACK && h == l.bh); y = y->left) {
+            h -= y->fea.color == BLACK;
+            p = y;
+        }
+        join_hang(s, p, 1, l.root, k, y);
+    }
+    grew = rb_insert_fixup(s, k);
+    l.bh = (l.bh > r.bh ? l.bh : r.bh) + grew;
+    l.root = s->root;
+    return l;
+}
+
+static struct piece avl_join(struct tree *s, struct piece l, struct tree_node *k,
+                             struct piece r) {
+    struct tree_node *y, *p = t_nil;
+    int hl = l.root->fea.height, hr = r.root->fea.height;
+    if (hl - hr <= 1 && hr - hl <= 1) {
+        join_root(s, l.root, k, r.root);
+        update_height(k);
+    } else if (hl > hr) {
+        s->root = y = l.root;
+        for (; y->fea.height > hr + 1; y = y->right)
+            p = y;
+        join_hang(s, p, 0, y, k, r.root);
+        update_height(k);
+        avl_delete_fixup(s, p);
+    } else {
+        s->root = y = r.root;
+        for (; y->fea.height > hl + 1; y = y->left)
+            p = y;
+        join_hang(s, p, 1, l.root, k, y);
+        update_height(k);
+        avl_delete_fixup(s, p);
+    }
+    l.root = s->root;
+    return l;
+}
+
+/* k on top, then sift it down until the heap order holds again */
+static struct piece treap_join(struct tree *s, struct piece l, struct tree_node *k,
+                               struct piece r) {
+    join_root(s, l.root, k, r.root);
+    for (;;) {
+        struct tree_node *c = treap_pri_less(s, k->left, k->right) ? k->right : k->left;
+        if (c == t_nil || !treap_pri_less(s, k, c))
+            break;
+        if (c == k->left)
+            bst_right_rotate(s, k);
+        else
+            bst_left_rotate(s, k);
+    }
+    l.root = s->root;
+    return l;
+}
+
+/* all keys of l < k->key < all keys of r */
+static struct piece join_pieces(struct tree *t, struct piece l, struct tree_node *k,
+                                struct piece r) {
+    struct tree s = *t;
+    switch (t->type) {
+        case T_RB:
+            return rb_join(&s, l, k, r);
+        case T_AVL:
+            return avl_join(&s, l, k, r);
+        case T_TREAP:
+            return treap_join(&s, l, k, r);
+        default:
+            join_root(&s, l.root, k, r.root);
+            l.root = k;
+            return l;
+    }
+}
+
+/* join without a pivot: borrow the maximum of l */
+static struct piece join2_pieces(struct tree *t, struct piece l, struct piece r) {
+    struct tree s = *t;
+    struct tree_node *k;
+    if (l.root == t_nil)
+        return r;
+    if (r.root == t_nil)
+        return l;
+    s.root = l.root;
+    k = tree_max(&s, s.root);
+    tree_delete(&s, k);
+    return join_pieces(t, tree_piece(&s), k, r);
+}
+
+/* x into keys < key and keys > key; returns the node equal to key, or t_nil */
+static struct tree_node *split_piece(struct tree *t, struct piece x, void *key,
+                                     struct piece *l, struct piece *r) {
+    struct tree_node *n = x.root, *m;
+    struct piece a, b;
+    if (n == t_nil) {
+        *l = *r = x;
+        return t_nil;
+    }
+    a = piece_of(t, n->left, child_bh(t, x));
+    b = piece_of(t, n->right, child_bh(t, x));
+    int c = tree_key_cmp(t, key, n->key);
+    if (c == 0) {
+        *l = a;
+        *r = b;
+        return n;
+    }
+    if (c < 0) {
+        m = split_piece(t, a, key, l, r);
+        *r = join_pieces(t, *r, n, b);
     } else {
-        if (z == z->p->left)
-            z->p->left = t_nil;
+        m = split_piece(t, b, key, l, r);
+        *l = join_pieces(t, a, n, *l);
+    }
+    return m;
+}
+
+static void unlink_node(struct tree_node *x) {
+    x->p = x->left = x->right = t_nil;
+}
+
+/* hand every node of p to drop, bottom-up so drop may free them */
+static void drop_piece(struct piece p, tree_drop_fn drop, void *ctx) {
+    struct tree_node *x = p.root;
+    if (!drop)
+        return;
+    while (x != t_nil) {
+        if (x->left != t_nil) {
+            x = x->left;
+        } else if (x->right != t_nil) {
+            x = x->right;
+        } else {
+            struct tree_node *up = x->p;
+            if (up != t_nil) {
+                if (up->left == x)
+                    up->left = t_nil;
+                else
+                    up->right = t_nil;
+            }
+            unlink_node(x);
+            drop(x, ctx);
+            x = up;
+        }
+    }
+}
+
+static void drop_node(struct tree_node *x, tree_drop_fn drop, void *ctx) {
+    unlink_node(x);
+    if (drop)
+        drop(x, ctx);
+}
+
+struct tree_node *tree_split(struct tree *t, void *key, struct tree *left,
+                             struct tree *right) {
+    assert(t);
+    assert(t->type != T_BTREE);
+    assert(left);
+    assert(right);
+    struct tree proto = *t;
+    struct piece l, r;
+    struct tree_node *m = split_piece(t, tree_piece(t), key, &l, &r);
+    proto.root = t_nil;
+    *t = proto;
+    *left = proto;
+    *right = proto;
+    left->root = l.root;
+    right->root = r.root;
+    if (m != t_nil)
+        unlink_node(m);
+    return m;
+}
+
+void tree_join(struct tree *left, struct tree_node *k, struct tree *right) {
+    assert(left);
+    assert(right);
+    assert(left != right);
+    assert(left->type != T_BTREE);
+    left->root = join_pieces(left, tree_piece(left), k, tree_piece(right)).root;
+    right->root = t_nil;
+}
+
+/*
+ * The set operations below follow Blelloch, Ferizovic and Sun, "Just Join
+ * for Parallel Ordered Sets": split the other tree by our root, recurse on
+ * both sides and join. Merging m keys into n costs O(m log(n/m + 1)).
+ */
+static struct piece union_pieces(struct tree *t, struct piece a, struct piece b,
+                                 tree_drop_fn drop, void *ctx) {
+    struct tree_node *k = a.root, *m;
+    struct piece al, ar, bl, br;
+    if (a.root == t_nil)
+        return b;
+    if (b.root == t_nil)
+        return a;
+    al = piece_of(t, k->left, child_bh(t, a));
+    ar = piece_of(t, k->right, child_bh(t, a));
+    m = split_piece(t, b, k->key, &bl, &br);
+    if (m != t_nil)
+        drop_node(m, drop, ctx);
+    al = union_pieces(t, al, bl, drop, ctx);
+    ar = union_pieces(t, ar, br, drop, ctx);
+    return join_pieces(t, al, k, ar);
+}
+
+static struct piece intersection_pieces(struct tree *t, struct piece a, struct piece b,
+                                        tree_drop_fn drop, void *ctx) {
+    struct tree_node *k = a.root, *m;
+    struct piece al, ar, bl, br;
+    if (a.root == t_nil || b.root == t_nil) {
+        drop_piece(a, drop, ctx);
+        drop_piece(b, drop, ctx);
+        a.root = t_nil;
+        a.bh = 0;
+        return a;
+    }
+    al = piece_of(t, k->left, child_bh(t, a));
+    ar = piece_of(t, k->right, child_bh(t, a));
+    m = split_piece(t, b, k->key, &bl, &br);
+    al = intersection_pieces(t, al, bl, drop, ctx);
+    ar = intersection_pieces(t, ar, br, drop, ctx);
+    if (m != t_nil) {
+        drop_node(m, drop, ctx);
+        return join_pieces(t, al, k, ar);
+    }
+    drop_node(k, drop, ctx);
+    return join2_pieces(t, al, ar);
+}
+
+static struct piece difference_pieces(struct tree *t, struct piece a, struct piece b,
+                                      tree_drop_fn drop, void *ctx) {
+    struct tree_node *k = a.root, *m;
+    struct piece al, ar, bl, br;
+    if (a.root == t_nil) {
+        drop_piece(b, drop, ctx);
+        return a;
+    }
+    if (b.root == t_nil)
+        return a;
+    al = piece_of(t, k->left, child_bh(t, a));
+    ar = piece_of(t, k->right, child_bh(t, a));
+    m = split_piece(t, b, k->key, &bl, &br);
+    al = difference_pieces(t, al, bl, drop, ctx);
+    ar = difference_pieces(t, ar, br, drop, ctx);
+    if (m != t_nil) {
+        drop_node(m, drop, ctx);
+        drop_node(k, drop, ctx);
+        return join2_pieces(t, al, ar);
+    }
+    return join_pieces(t, al, k, ar);
+}
+
+void tree_union(struct tree *t1, struct tree *t2, tree_drop_fn drop, void *ctx) {
+    assert(t1);
+    assert(t2);
+    assert(t1 != t2);
+    assert(t1->type != T_BTREE);
+    t1->root = union_pieces(t1, tree_piece(t1), tree_piece(t2), drop, ctx).root;
+    t2->root = t_nil;
+}
+
+void tree_intersection(struct tree *t1, struct tree *t2, tree_drop_fn drop, void *ctx) {
+    assert(t1);
+    assert(t2);
+    assert(t1 != t2);
+    assert(t1->type != T_BTREE);
+    t1->root = intersection_pieces(t1, tree_piece(t1), tree_piece(t2), drop, ctx).root;
+    t2->root = t_nil;
+}
+
+void tree_difference(struct tree *t1, struct tree *t2, tree_drop_fn drop, void *ctx) {
+    assert(t1);
+    assert(t2);
+    assert(t1 != t2);
+    assert(t1->type != T_BTREE);
+    t1->root = difference_pieces(t1, tree_piece(t1), tree_piece(t2), drop, ctx).root;
+    t2->root = t_nil;
+}
+
+/*
+ * Batch insert and delete. The batch is sorted, then placed in one descent
+ * of the tree shared by all its keys: a node is visited once, however many
+ * keys pass it, and splits the sorted range it was handed between its two
+ * subtrees. The descent goes a level at a time and prefetches the whole
+ * next level, so the cache misses of a level overlap. It leaves each key
+ * with the node whose empty child slot it falls into, or the node holding
+ * it already, in its p field.
+ *
+ * The keys are then linked in ascending order. A key whose slot is still
+ * empty is hung there directly; one whose slot an earlier key or rotation
+ * has taken is finger-inserted from the key before it, a few steps away.
+ * Rebalancing still runs once per key, but on a region the previous key
+ * has just pulled into cache.
+ *
+ * Deletes are given nodes, so there is nothing to search for; they only
+ * prefetch and remove one node at a time.
+ */
+struct batch_run {
+    struct tree_node *x;
+    size_t lo, hi;
+};
+
+/* first index in [lo, hi) whose key is not below x's */
+static size_t batch_split(struct tree *t, struct tree_node **a, size_t lo, size_t hi,
+                          struct tree_node *x) {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tree_key_cmp(t, a[mid]->key, x->key) < 0)
+            lo = mid + 1;
         else
-            z->p->right = t_nil;
-        avl_delete_fixup(t, z->p);
+            hi = mid;
+    }
+    return lo;
+}
+
+/* send a[lo, hi) below x: queue the child, or park the keys on x if empty */
+static void batch_push(struct batch_run *next, size_t *m, struct tree_node *child,
+                       struct tree_node *x, struct tree_node **a, size_t lo, size_t hi) {
+    size_t i;
+    if (lo == hi)
+        return;
+    if (child == t_nil) {
+        for (i = lo; i < hi; i++)
+            a[i]->p = x;
+        return;
+    }
+    __builtin_prefetch(child);
+    next[*m].x = child;
+    next[*m].lo = lo;
+    next[*m].hi = hi;
+    (*m)++;
+}
+
+/* one level-by-level descent setting each a[i]->p as described above */
+static void batch_place(struct tree *t, struct tree_node **a, size_t n) {
+    struct batch_run *cur, *next, *tmp;
+    size_t i, m, k;
+    for (i = 0; i < n; i++)
+        a[i]->p = t_nil;
+    if (t->root == t_nil || n == 0)
+        return;
+    cur = malloc(2 * n * sizeof(*cur));
+    assert(cur);
+    next = cur + n;
+    cur[0].x = t->root;
+    cur[0].lo = 0;
+    cur[0].hi = n;
+    for (m = 1; m > 0;) {
+        for (i = 0, k = 0; i < m; i++) {
+            struct tree_node *x = cur[i].x;
+            size_t lo = batch_split(t, a, cur[i].lo, cur[i].hi, x), hi = lo;
+            TREE_STAT(visited);
+            while (hi < cur[i].hi && tree_key_cmp(t, a[hi]->key, x->key) == 0)
+                a[hi++]->p = x;
+            batch_push(next, &k, x->left, x, a, cur[i].lo, lo);
+            batch_push(next, &k, x->right, x, a, hi, cur[i].hi);
+        }
+        tmp = cur;
+        cur = next;
+        next = tmp;
+        m = k;
+    }
+    free(cur < next ? cur : next);
+}
+
+static int node_cmp(struct tree *t, struct tree_node *a, struct tree_node *b) {
+    return tree_key_cmp(t, a->key, b->key);
+}
+
+static void sift_down(struct tree *t, struct tree_node **a, size_t i, size_t n) {
+    for (;;) {
+        size_t c = 2 * i + 1;
+        struct tree_node *x;
+        if (c >= n)
+            break;
+        if (c + 1 < n && node_cmp(t, a[c], a[c + 1]) < 0)
+            c++;
+        if (node_cmp(t, a[i], a[c]) >= 0)
+            break;
+        x = a[i];
+        a[i] = a[c];
+        a[c] = x;
+        i = c;
+    }
+}
+
+/* heap sort in place, so nothing is allocated; skipped for sorted input */
+static void sort_nodes(struct tree *t, struct tree_node **a, size_t n) {
+    size_t i;
+    for (i = 1; i < n && node_cmp(t, a[i - 1], a[i]) <= 0; i++)
+        ;
+    if (i >= n)
+        return;
+    for (i = n / 2; i-- > 0;)
+        sift_down(t, a, i, n);
+    for (i = n; i-- > 1;) {
+        struct tree_node *x = a[0];
+        a[0] = a[i];
+        a[i] = x;
+        sift_down(t, a, 0, i);
+    }
+}
+
+void tree_insert_batch(struct tree *t, struct tree_node **nodes, size_t n,
+                       tree_drop_fn drop, void *ctx) {
+    struct tree_node *prev = t_nil, *x;
+    size_t i;
+    assert(t);
+    assert(nodes || n == 0);
+    sort_nodes(t, nodes, n);
+    if (t->type != T_BTREE)
+        batch_place(t, nodes, n);
+    for (i = 0; i < n; i++) {
+        struct tree_node *z = nodes[i], *y = t->type == T_BTREE ? t_nil : z->p;
+        int c = y == t_nil ? 1 : tree_key_cmp(t, z->key, y->key);
+        if (i > 0 && node_cmp(t, nodes[i - 1], z) == 0)
+            x = prev;
+        else if (c == 0)
+            x = y;
+        /* a right slot is stale once an earlier key went in between */
+        else if (y != t_nil && (c < 0 ? y->left : y->right) == t_nil &&
+                 (c < 0 || prev == t_nil || tree_key_cmp(t, prev->key, y->key) < 0)) {
+            insert_at(t, y, z, c < 0);
+            x = z;
+        } else {
+            x = tree_insert_from(t, prev != t_nil ? prev : y, z);
+        }
+        if (x != z && drop)
+            drop(z, ctx);
+        prev = x;
+    }
+}
+
+void tree_delete_batch(struct tree *t, struct tree_node **nodes, size_t n) {
+    size_t i;
+    assert(t);
+    assert(nodes || n == 0);
+    /* fetch each node a few deletes ahead, then what it links to */
+    for (i = 0; i < n; i++) {
+        if (i + 16 < n)
+            __builtin_prefetch(nodes[i + 16]);
+        if (i + 8 < n) {
+            __builtin_prefetch(nodes[i + 8]->p);
+            __builtin_prefetch(nodes[i + 8]->right);
+        }
+        tree_delete(t, nodes[i]);
     }
 }
@@ -1,3 +1,6 @@
+#ifndef TREES_H
+#define TREES_H
+
 #include <stdio.h>
 #include <assert.h>
 
@@ -10,7 +13,7 @@ enum rb_color {
 };
 
 enum rb_tree_type {
-    T_BST,T_RB,T_AVL,T_TREAP
+    T_BST,T_RB,T_AVL,T_TREAP,T_BTREE
 };
 
 struct tree_node {
@@ -24,37 +27,191 @@ struct tree_node {
     void *data;    
 };
 
+/*
+ * Node for trees with order_stat or agg_combine set: every node of such a
+ * tree must be one of these, so plain trees do not pay for the extra
+ * fields.
+ */
+struct tree_node_aug {
+    struct tree_node node;
+    /* nodes in this subtree, kept when order_stat is set */
+    size_t size;
+    /* subtree aggregate, kept when agg_combine is set */
+    long agg;
+};
+
+static inline struct tree_node_aug *tree_aug(struct tree_node *x) {
+    return (struct tree_node_aug *)x;
+}
+
+struct btree_node;
+
 struct tree {
     int (*key_less)(void *key1, void *key2);
     int (*priority_less)(void *key1, void *key2);
     struct tree_node *root;
     enum rb_tree_type type;
+    /* optional three-way compare (<0, 0, >0); one call per level when set */
+    int (*key_cmp)(void *key1, void *key2);
+    /* maintain tree_node_aug::size, enabling tree_select and tree_rank */
+    int order_stat;
+    /* T_BTREE only: the B+-tree index; root stays t_nil */
+    struct btree_node *btree;
+    /* keys are (void *)(long) integers compared as signed longs; key_less
+       and key_cmp are not used, and T_BTREE searches nodes with SIMD */
+    int int_keys;
+    /* augmentation: each node's tree_node_aug::agg folds agg_combine, in
+       key order, over agg_value of every node in its subtree. agg_combine
+       must be associative; see tree_aggregate */
+    long (*agg_value)(struct tree_node *x);
+    long (*agg_combine)(long a, long b);
+    /* publish links with release stores for lock-free readers; set by
+       tree_rw_init */
+    int release_links;
+};
+
+/* shared, read-only sentinel: never written, so trees need no global lock */
+extern const struct tree_node_aug t_null_node;
+extern struct tree_node *const t_nil;
+
+/* in-order cursor; see tree_iter_next/tree_iter_prev */
+struct tree_iter {
+    struct tree *t;
+    struct tree_node *node;
 };
 
-extern struct tree_node t_null_node;
-extern struct tree_node *t_nil;
+/* receives nodes a set operation removes from both trees */
+typedef void (*tree_drop_fn)(struct tree_node *n, void *ctx);
 
-#define T_INITIAL {NULL, NULL, t_nil, T_BST}
+#define T_INITIAL {NULL, NULL, t_nil, T_BST, NULL, 0, NULL, 0, NULL, NULL, 0}
 #define N_INITIAL {t_nil, t_nil, t_nil, {RED}, t_nil, t_nil}
 
+/*
+ * Operation counters, built in only with -DTREE_STATS (make STATS=1) so the
+ * default build pays nothing. They are per thread and never reset by the
+ * library: clear tree_stats before a phase and read it after.
+ */
+#ifdef TREE_STATS
+struct tree_stats {
+    unsigned long comparisons;  /* tree_key_cmp calls */
+    unsigned long rotations;
+    unsigned long fixups;       /* rebalancing loop iterations */
+    unsigned long visited;      /* nodes passed on search descents */
+};
+extern __thread struct tree_stats tree_stats;
+#define TREE_STAT(field) (tree_stats.field++)
+#else
+#define TREE_STAT(field) ((void)0)
+#endif
+
+/* three-way key compare: int_keys inline, else one key_cmp call if the tree
+   has one, otherwise at most two key_less */
+static inline int tree_key_cmp(struct tree *t, void *k1, void *k2) {
+    TREE_STAT(comparisons);
+    if (t->int_keys)
+        return ((long)k1 > (long)k2) - ((long)k1 < (long)k2);
+    if (t->key_cmp)
+        return t->key_cmp(k1, k2);
+    if (t->key_less(k1, k2))
+        return -1;
+    return t->key_less(k2, k1) ? 1 : 0;
+}
+
 int tree_height(struct tree *t, struct tree_node *x);
 void tree_travel(struct tree *t, struct tree_node *r, void(*fn)(struct tree_node *n));
 struct tree_node *tree_search(struct tree *t, void *key);
+/* out[i] = tree_search(t, keys[i]) for each i < n, with the lookups
+   interleaved so their cache misses overlap */
+void tree_search_batch(struct tree *t, void **keys, size_t n, struct tree_node **out);
 struct tree_node *tree_min(struct tree *t, struct tree_node *r);
 struct tree_node *tree_max(struct tree *t, struct tree_node *r);
 struct tree_node *tree_successor(struct tree *t, struct tree_node *x);
 struct tree_node *tree_predecessor(struct tree *t, struct tree_node *x);
 void bst_right_rotate(struct tree *t, struct tree_node *x);
 void bst_left_rotate(struct tree *t, struct tree_node *x);
+void bst_link(struct tree *t, struct tree_node *p, struct tree_node *z, int left);
 struct tree_node *bst_insert(struct tree *t, struct tree_node *z);
 void bst_delete(struct tree *t, struct tree_node *z);
 void rb_tree_delete(struct tree *t, struct tree_node *z);
 struct tree_node *rb_tree_insert(struct tree *t, struct tree_node *z);
+int rb_insert_fixup(struct tree *t, struct tree_node *z);
 void treap_delete(struct tree *t, struct tree_node *z);
 struct tree_node *treap_insert(struct tree *t, struct tree_node *z);
+void treap_insert_fixup(struct tree *t, struct tree_node *z);
 void avl_delete(struct tree *t, struct tree_node *z);
 struct tree_node *avl_insert(struct tree *t, struct tree_node *z);
+void avl_insert_fixup(struct tree *t, struct tree_node *z);
+/* k-th smallest node, counting from 0 (t_nil if k >= size) */
+struct tree_node *tree_select(struct tree *t, size_t k);
+/* number of keys less than key */
+size_t tree_rank(struct tree *t, void *key);
+/* link n nodes, sorted by strictly ascending key, into the empty tree t in O(n) */
+void tree_build_sorted(struct tree *t, struct tree_node **nodes, size_t n);
+/* first node with key >= key / key > key, t_nil if none */
+struct tree_node *tree_lower_bound(struct tree *t, void *key);
+struct tree_node *tree_upper_bound(struct tree *t, void *key);
+/* position it on x; next/prev return the current node and step, t_nil at the end */
+void tree_iter_init(struct tree_iter *it, struct tree *t, struct tree_node *x);
+struct tree_node *tree_iter_next(struct tree_iter *it);
+struct tree_node *tree_iter_prev(struct tree_iter *it);
+/* call fn on each node with lo <= key <= hi in order until it returns
+   nonzero; returns that value, or 0 */
+int tree_range(struct tree *t, void *lo, void *hi,
+               int (*fn)(struct tree_node *n, void *ctx), void *ctx);
+/* fold agg_combine over the values of the nodes with lo <= key <= hi in
+   O(log n); returns 0 if there are none, else 1 with the result in *out */
+int tree_aggregate(struct tree *t, void *lo, void *hi, long *out);
+/* refresh the aggregates above x after its value changed */
+void tree_update(struct tree *t, struct tree_node *x);
+/* insert/delete dispatching on t->type */
+struct tree_node *tree_insert(struct tree *t, struct tree_node *z);
+void tree_delete(struct tree *t, struct tree_node *z);
+/* tree_search/tree_insert starting from finger, a node of t near the key
+   (t_nil for none): O(log d) for a key d places from it, in place of
+   O(log n), on the balanced trees */
+struct tree_node *tree_search_from(struct tree *t, struct tree_node *finger, void *key);
+struct tree_node *tree_insert_from(struct tree *t, struct tree_node *finger,
+                                   struct tree_node *z);
+/* insert the n nodes, in any order: they are sorted (nodes is left so),
+   placed by one level-by-level descent shared by the whole batch, then
+   linked in order. A node whose key t already holds, or that repeats a key
+   of the batch, is left out and passed to drop (may be NULL) */
+void tree_insert_batch(struct tree *t, struct tree_node **nodes, size_t n,
+                       tree_drop_fn drop, void *ctx);
+/* remove the n distinct nodes, all in t, one tree_delete each but with
+   every node prefetched a few deletes ahead of time */
+void tree_delete_batch(struct tree *t, struct tree_node **nodes, size_t n);
+/* move keys < key into left and keys > key into right, emptying t; returns
+   the unlinked node equal to key, or t_nil. left/right inherit t's settings */
+struct tree_node *tree_split(struct tree *t, void *key, struct tree *left,
+                             struct tree *right);
+/* left = left + k + right, all keys of left < k < all keys of right; right
+   is left empty */
+void tree_join(struct tree *left, struct tree_node *k, struct tree *right);
+/* t1 = t1 op t2, emptying t2; nodes in neither result go to drop (may be
+   NULL). On equal keys the union and intersection keep t1's node */
+void tree_union(struct tree *t1, struct tree *t2, tree_drop_fn drop, void *ctx);
+void tree_intersection(struct tree *t1, struct tree *t2, tree_drop_fn drop, void *ctx);
+void tree_difference(struct tree *t1, struct tree *t2, tree_drop_fn drop, void *ctx);
+/* T_BTREE engine (btree.c); the tree_* calls above dispatch to these.
+   tree_select/rank, split/join, the set operations and aggregates are not
+   supported */
+struct tree_node *btree_search(struct tree *t, void *key);
+struct tree_node *btree_bound(struct tree *t, void *key, int upper);
+struct tree_node *btree_min(struct tree *t);
+struct tree_node *btree_max(struct tree *t);
+struct tree_node *btree_successor(struct tree *t, struct tree_node *x);
+struct tree_node *btree_predecessor(struct tree *t, struct tree_node *x);
+int btree_height(struct tree *t);
+void btree_travel(struct tree *t, void (*fn)(struct tree_node *n));
+struct tree_node *btree_insert(struct tree *t, struct tree_node *z);
+void btree_delete(struct tree *t, struct tree_node *z);
+void btree_build_sorted(struct tree *t, struct tree_node **nodes, size_t n);
+/* free the index; entries are left to the caller */
+void btree_destroy(struct tree *t);
 
 #ifdef __cplusplus
 }
 #endif
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef TREES_HPP
+#define TREES_HPP
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <random>
+#include <tuple>
+#include <utility>
+
+#include "trees.h"
+
+/*
+ * Header-only, type-specialised front end for trees.c.
+ *
+ * Keys and values live inline in the node and the comparator is a template
+ * parameter, so searches compile down to direct, inlinable comparisons.
+ * Only the descent is done here; linking and rebalancing reuse the C
+ * algorithms (bst_link plus the rb/avl/treap insert fixups and deletes).
+ */
+namespace trees {
+
+struct rb_balance {
+    static const rb_tree_type type = T_RB;
+    static void insert_fixup(struct tree *t, struct tree_node *z) {
+        rb_insert_fixup(t, z);
+    }
+    static void erase(struct tree *t, struct tree_node *z) {
+        rb_tree_delete(t, z);
+    }
+};
+
+struct avl_balance {
+    static const rb_tree_type type = T_AVL;
+    static void insert_fixup(struct tree *t, struct tree_node *z) {
+        avl_insert_fixup(t, z);
+    }
+    static void erase(struct tree *t, struct tree_node *z) {
+        avl_delete(t, z);
+    }
+};
+
+struct treap_balance {
+    static const rb_tree_type type = T_TREAP;
+    static void insert_fixup(struct tree *t, struct tree_node *z) {
+        treap_insert_fixup(t, z);
+    }
+    static void erase(struct tree *t, struct tree_node *z) {
+        treap_delete(t, z);
+    }
+};
+
+template <class Key, class Value, class Compare = std::less<Key>,
+          class Balance = rb_balance>
+class tree_map {
+public:
+    typedef Key key_type;
+    typedef Value mapped_type;
+    typedef std::pair<const Key, Value> value_type;
+    typedef std::size_t size_type;
+    typedef Compare key_compare;
+
+private:
+    struct node : tree_node {
+        value_type kv;
+        template <class... Args>
+        explicit node(Args&&... args) : kv(std::forward<Args>(args)...) {
+            key = const_cast<Key*>(&kv.first);
+            data = &kv.second;
+        }
+    };
+
+    static node* to_node(struct tree_node* x) { return static_cast<node*>(x); }
+
+    static int pri_less(void* a, void* b) {
+        return reinterpret_cast<unsigned long>(a) <
+               reinterpret_cast<unsigned long>(b);
+    }
+
+public:
+    template <class Ref, class Ptr>
+    class basic_iterator {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef typename tree_map::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Ptr pointer;
+        typedef Ref reference;
+
+        basic_iterator() : t_(NULL), x_(t_nil) {}
+        // iterator -> const_iterator
+        basic_iterator(const basic_iterator<value_type&, value_type*>& o)
+            : t_(o.t_), x_(o.x_) {}
+
+        reference operator*() const { return to_node(x_)->kv; }
+        pointer operator->() const { return &to_node(x_)->kv; }
+        basic_iterator& operator++() {
+            x_ = tree_successor(t_, x_);
+            return *this;
+        }
+        basic_iterator operator++(int) {
+            basic_iterator r = *this;
+            ++*this;
+            return r;
+        }
+        basic_iterator& operator--() {
+            x_ = x_ == t_nil ? tree_max(t_, t_->root)
+                             : tree_predecessor(t_, x_);
+            return *this;
+        }
+        basic_iterator operator--(int) {
+            basic_iterator r = *this;
+            --*this;
+            return r;
+        }
+        bool operator==(const basic_iterator& o) const { return x_ == o.x_; }
+        bool operator!=(const basic_iterator& o) const { return x_ != o.x_; }
+
+    private:
+        friend class tree_map;
+        template <class, class>
+        friend class basic_iterator;
+        basic_iterator(struct tree* t, struct tree_node* x) : t_(t), x_(x) {}
+
+        struct tree* t_;
+        struct tree_node* x_;
+    };
+    typedef basic_iterator<value_type&, value_type*> iterator;
+    typedef basic_iterator<const value_type&, const value_type*> const_iterator;
+
+    explicit tree_map(const Compare& comp = Compare()) : comp_(comp), n_(0) {
+        struct tree t = T_INITIAL;
+        t_ = t;
+        t_.type = Balance::type;
+        t_.priority_less = pri_less;
+    }
+    tree_map(const tree_map&) = delete;
+    tree_map& operator=(const tree_map&) = delete;
+    ~tree_map() { clear(); }
+
+    iterator begin() { return iterator(&t_, tree_min(&t_, t_.root)); }
+    iterator end() { return iterator(&t_, t_nil); }
+    const_iterator begin() const {
+        return const_iterator(raw(), tree_min(raw(), t_.root));
+    }
+    const_iterator end() const { return const_iterator(raw(), t_nil); }
+
+    bool empty() const { return n_ == 0; }
+    size_type size() const { return n_; }
+
+    iterator find(const Key& key) { return iterator(&t_, search(key)); }
+    const_iterator find(const Key& key) const {
+        return const_iterator(raw(), search(key));
+    }
+    size_type count(const Key& key) const { return search(key) != t_nil; }
+
+    iterator lower_bound(const Key& key) {
+        return iterator(&t_, bound(key, false));
+    }
+    iterator upper_bound(const Key& key) {
+        return iterator(&t_, bound(key, true));
+    }
+
+    std::pair<iterator, bool> insert(const value_type& v) {
+        return emplace(v);
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        node* z = new node(std::forward<Args>(args)...);
+        struct tree_node* p;
+        bool left;
+        struct tree_node* x = locate(z->kv.first, &p, &left);
+        if (x != t_nil) {
+            delete z;
+            return std::make_pair(iterator(&t_, x), false);
+        }
+        link(z, p, left);
+        return std::make_pair(iterator(&t_, z), true);
+    }
+
+    Value& operator[](const Key& key) {
+        struct tree_node* p;
+        bool left;
+        struct tree_node* x = locate(key, &p, &left);
+        if (x != t_nil)
+            return to_node(x)->kv.second;
+        node* z = new node(std::piecewise_construct, std::forward_as_tuple(key),
+                           std::forward_as_tuple());
+        link(z, p, left);
+        return z->kv.second;
+    }
+
+    iterator erase(iterator it) {
+        struct tree_node* x = it.x_;
+        ++it;
+        Balance::erase(&t_, x);
+        delete to_node(x);
+        n_--;
+        return it;
+    }
+
+    size_type erase(const Key& key) {
+        struct tree_node* x = search(key);
+        if (x == t_nil)
+            return 0;
+        erase(iterator(&t_, x));
+        return 1;
+    }
+
+    // post-order teardown through parent pointers, no recursion
+    void clear() {
+        struct tree_node* x = t_.root;
+        while (x != t_nil) {
+            if (x->left != t_nil) {
+                x = x->left;
+            } else if (x->right != t_nil) {
+                x = x->right;
+            } else {
+                struct tree_node* p = x->p;
+                if (p != t_nil) {
+                    if (p->left == x)
+                        p->left = t_nil;
+                    else
+                        p->right = t_nil;
+                }
+                delete to_node(x);
+                x = p;
+            }
+        }
+        t_.root = t_nil;
+        n_ = 0;
+    }
+
+private:
+    struct tree* raw() const { return const_cast<struct tree*>(&t_); }
+
+    struct tree_node* search(const Key& key) const {
+        struct tree_node* x = t_.root;
+        while (x != t_nil) {
+            const Key& k = to_node(x)->kv.first;
+            if (comp_(key, k))
+                x = x->left;
+            else if (comp_(k, key))
+                x = x->right;
+            else
+                break;
+        }
+        return x;
+    }
+
+    // first node with key >= key (upper == false) or key > key (upper)
+    struct tree_node* bound(const Key& key, bool upper) const {
+        struct tree_node* x = t_.root;
+        struct tree_node* r = t_nil;
+        while (x != t_nil) {
+            const Key& k = to_node(x)->kv.first;
+            if (upper ? comp_(key, k) : !comp_(k, key)) {
+                r = x;
+                x = x->left;
+            } else {
+                x = x->right;
+            }
+        }
+        return r;
+    }
+
+    // the node holding key, or t_nil with *p/*left set to where it would hang
+    struct tree_node* locate(const Key& key, struct tree_node** p,
+                             bool* left) const {
+        struct tree_node* x = t_.root;
+        *p = t_nil;
+        *left = false;
+        while (x != t_nil) {
+            const Key& k = to_node(x)->kv.first;
+            *p = x;
+            if (comp_(key, k)) {
+                *left = true;
+                x = x->left;
+            } else if (comp_(k, key)) {
+                *left = false;
+                x = x->right;
+            } else {
+                return x;
+            }
+        }
+        return t_nil;
+    }
+
+    void link(node* z, struct tree_node* p, bool left) {
+        if (Balance::type == T_TREAP)
+            z->fea.priority = reinterpret_cast<void*>(
+                static_cast<unsigned long>(rng_()));
+        bst_link(&t_, p, z, left);
+        Balance::insert_fixup(&t_, z);
+        n_++;
+    }
+
+    struct tree t_;
+    Compare comp_;
+    size_type n_;
+    std::minstd_rand rng_;
+};
+
+}  // namespace trees
+
+#endif
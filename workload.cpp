@@ -0,0 +1,582 @@
+// Workload engine: loads n keys into each tree type in a chosen order, runs
+// a YCSB-style operation mix against it, then deletes every key left, and
+// prints one CSV row per tree, run and phase with throughput and latency
+// percentiles. perf=1 adds hardware counters per op; a build with
+// make STATS=1 adds comparisons, rotations, fixup steps and nodes visited.
+//
+//   ./workload n=1000000 keys=int load=sorted mix=A dist=zipf
+//   ./workload help
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "trees.h"
+#include "hdr_hist.h"
+#include "perf_counters.h"
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::vector;
+
+enum op_type {
+    OP_READ, OP_UPDATE, OP_INSERT, OP_DELETE, OP_SCAN, OP_RMW, OP_TYPES
+};
+
+static const char *const op_names[OP_TYPES] = {
+    "read", "update", "insert", "delete", "scan", "rmw"
+};
+
+struct spec {
+    string keys = "str";        // int | str
+    size_t klen = 10;           // str: key length
+    size_t prefix = 0;          // str: bytes every key shares up front
+    size_t n = 100000;          // keys loaded before the run
+    size_t ops = 100000;        // operations in the run phase
+    string load = "random";     // random | sorted | reverse | nearly
+    double nearly = 0.01;       // nearly: fraction of keys moved out of place
+    string mix = "C";           // A-F, or the fractions below
+    double frac[OP_TYPES] = {0, 0, 0, 0, 0, 0};
+    string dist = "";           // uniform | zipf | latest; the mix's default
+    double theta = 0.99;        // zipf exponent
+    double miss = 0;            // fraction of reads on keys not in the tree
+    size_t scanlen = 100;       // scan: at most this many keys per scan
+    string trees = "bst,rb,avl,treap,btree";
+    int runs = 1;
+    unsigned seed = 1;
+    int perf = 0;               // 1: read hardware counters per phase
+};
+
+static void usage() {
+    spec s;
+    cerr << "USAGE: workload [key=value ...]\n"
+         << "  n=" << s.n << " ops=" << s.ops << " runs=" << s.runs << " seed=" << s.seed << "\n"
+         << "  keys=int|str klen=" << s.klen << " prefix=" << s.prefix << "\n"
+         << "  load=random|sorted|reverse|nearly nearly=" << s.nearly << "\n"
+         << "  mix=A|B|C|D|E|F, or read= update= insert= delete= scan= rmw= fractions\n"
+         << "  dist=uniform|zipf|latest theta=" << s.theta << " miss=" << s.miss
+         << " scanlen=" << s.scanlen << "\n"
+         << "  trees=" << s.trees << " perf=" << s.perf << "\n"
+         << "YCSB mixes: A 50/50 read/update, B 95/5 read/update, C read only,\n"
+         << "  D 95/5 read/insert on the latest keys, E 95/5 scan/insert,\n"
+         << "  F 50/50 read/read-modify-write" << endl;
+}
+
+// fractions and default key distribution of the YCSB core workloads
+static bool set_mix(spec &s) {
+    static const std::map<string, vector<double>> mixes = {
+        {"A", {0.5, 0.5, 0, 0, 0, 0}},
+        {"B", {0.95, 0.05, 0, 0, 0, 0}},
+        {"C", {1, 0, 0, 0, 0, 0}},
+        {"D", {0.95, 0, 0.05, 0, 0, 0}},
+        {"E", {0, 0, 0.05, 0, 0.95, 0}},
+        {"F", {0.5, 0, 0, 0, 0, 0.5}},
+    };
+    auto it = mixes.find(s.mix);
+    if (it == mixes.end())
+        return false;
+    std::copy(it->second.begin(), it->second.end(), s.frac);
+    if (s.dist.empty())
+        s.dist = s.mix == "D" ? "latest" : s.mix == "C" ? "uniform" : "zipf";
+    return true;
+}
+
+static double frac_sum(const spec &s) {
+    double sum = 0;
+    for (auto f: s.frac) {
+        sum += f;
+    }
+    return sum;
+}
+
+static bool parse(spec &s, int argc, char *argv[]) {
+    bool custom = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (eq == string::npos)
+            return false;
+        string k = arg.substr(0, eq);
+        std::istringstream v(arg.substr(eq + 1));
+        int op = std::find(op_names, op_names + OP_TYPES, k) - op_names;
+        if (op < OP_TYPES) {
+            v >> s.frac[op];
+            custom = true;
+        } else if (k == "keys") {
+            v >> s.keys;
+        } else if (k == "klen") {
+            v >> s.klen;
+        } else if (k == "prefix") {
+            v >> s.prefix;
+        } else if (k == "n") {
+            v >> s.n;
+        } else if (k == "ops") {
+            v >> s.ops;
+        } else if (k == "load") {
+            v >> s.load;
+        } else if (k == "nearly") {
+            v >> s.nearly;
+        } else if (k == "mix") {
+            v >> s.mix;
+        } else if (k == "dist") {
+            v >> s.dist;
+        } else if (k == "theta") {
+            v >> s.theta;
+        } else if (k == "miss") {
+            v >> s.miss;
+        } else if (k == "scanlen") {
+            v >> s.scanlen;
+        } else if (k == "trees") {
+            v >> s.trees;
+        } else if (k == "runs") {
+            v >> s.runs;
+        } else if (k == "seed") {
+            v >> s.seed;
+        } else if (k == "perf") {
+            v >> s.perf;
+        } else {
+            return false;
+        }
+        if (v.fail())
+            return false;
+    }
+    if (custom) {
+        s.mix = "custom";
+        if (s.dist.empty())
+            s.dist = "uniform";
+    } else if (!set_mix(s)) {
+        return false;
+    }
+    return frac_sum(s) > 0 && (s.keys == "int" || s.keys == "str") &&
+           s.prefix <= s.klen && s.scanlen > 0 && s.runs > 0 && s.n > 0 &&
+           (s.dist == "uniform" || s.dist == "zipf" || s.dist == "latest") &&
+           (s.load == "random" || s.load == "sorted" || s.load == "reverse" ||
+            s.load == "nearly");
+}
+
+struct zipf_gen {
+    vector<double> cdf;
+    zipf_gen(size_t n, double s) : cdf(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+            cdf[i] = sum;
+        }
+        for (auto &c: cdf) {
+            c /= sum;
+        }
+    }
+    template <class Rng>
+    size_t operator()(Rng &r) const {
+        double u = std::uniform_real_distribution<double>(0, 1)(r);
+        size_t i = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return std::min(i, cdf.size() - 1);
+    }
+};
+
+static int str_less(void *a, void *b) {
+    return *static_cast<string*>(a) < *static_cast<string*>(b);
+}
+
+static int str_cmp(void *a, void *b) {
+    return static_cast<string*>(a)->compare(*static_cast<string*>(b));
+}
+
+static int pri_less(void *a, void *b) {
+    return reinterpret_cast<long>(a) < reinterpret_cast<long>(b);
+}
+
+// every key the run can touch: the n loaded ones, a pool for inserts and
+// a pool of keys that are never inserted, for missing-key reads
+struct key_set {
+    bool ints;
+    vector<long> nums;
+    vector<string> strs;
+    size_t size() const { return ints ? nums.size() : strs.size(); }
+    void *key(size_t i) {
+        return ints ? reinterpret_cast<void*>(nums[i]) : static_cast<void*>(&strs[i]);
+    }
+    bool less(size_t i, size_t j) const {
+        return ints ? nums[i] < nums[j] : strs[i] < strs[j];
+    }
+};
+
+static key_set make_keys(const spec &s, size_t count, std::mt19937_64 &rng) {
+    key_set ks;
+    ks.ints = s.keys == "int";
+    if (ks.ints) {
+        std::uniform_int_distribution<long> dist(0, 1L << 62);
+        while (ks.nums.size() < count) {
+            while (ks.nums.size() < count) {
+                ks.nums.push_back(dist(rng));
+            }
+            std::sort(ks.nums.begin(), ks.nums.end());
+            ks.nums.erase(std::unique(ks.nums.begin(), ks.nums.end()), ks.nums.end());
+        }
+        std::shuffle(ks.nums.begin(), ks.nums.end(), rng);
+        return ks;
+    }
+    static const char charset[] =
+        "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    std::uniform_int_distribution<int> ch(0, sizeof(charset) - 2);
+    string prefix(s.prefix, 0);
+    for (auto &c: prefix) {
+        c = charset[ch(rng)];
+    }
+    while (ks.strs.size() < count) {
+        while (ks.strs.size() < count) {
+            string k = prefix;
+            for (size_t i = s.prefix; i < s.klen; i++) {
+                k += charset[ch(rng)];
+            }
+            ks.strs.push_back(k);
+        }
+        std::sort(ks.strs.begin(), ks.strs.end());
+        ks.strs.erase(std::unique(ks.strs.begin(), ks.strs.end()), ks.strs.end());
+    }
+    std::shuffle(ks.strs.begin(), ks.strs.end(), rng);
+    return ks;
+}
+
+// the order the first n keys are loaded in
+static vector<size_t> load_order(const spec &s, key_set &ks, std::mt19937_64 &rng) {
+    vector<size_t> order(s.n);
+    for (size_t i = 0; i < s.n; i++) {
+        order[i] = i;
+    }
+    if (s.load == "random")
+        return order;
+    std::sort(order.begin(), order.end(),
+              [&ks](size_t a, size_t b) { return ks.less(a, b); });
+    if (s.load == "reverse") {
+        std::reverse(order.begin(), order.end());
+    } else if (s.load == "nearly") {
+        // swap a few keys with a neighbour up to 16 places on
+        size_t moves = static_cast<size_t>(s.nearly * s.n);
+        for (size_t m = 0; m < moves; m++) {
+            size_t i = rng() % s.n;
+            std::swap(order[i], order[std::min(s.n - 1, i + 1 + rng() % 16)]);
+        }
+    }
+    return order;
+}
+
+struct op {
+    unsigned char type;
+    bool miss;
+    size_t r;       // rank or random draw, resolved against the live keys
+    size_t len;     // scan length
+};
+
+static vector<op> make_ops(const spec &s, size_t misses, std::mt19937_64 &rng) {
+    vector<op> ops(s.ops);
+    std::discrete_distribution<int> pick(s.frac, s.frac + OP_TYPES);
+    std::uniform_real_distribution<double> u(0, 1);
+    zipf_gen zipf(s.dist == "uniform" ? 1 : s.n + s.ops, s.theta);
+    for (auto &o: ops) {
+        o.type = pick(rng);
+        o.miss = (o.type == OP_READ || o.type == OP_RMW) && misses && u(rng) < s.miss;
+        o.r = s.dist == "uniform" ? rng() : zipf(rng);
+        o.len = 1 + rng() % s.scanlen;
+    }
+    return ops;
+}
+
+static const double percentiles[] = {50, 90, 99, 99.9};
+
+static const char *const phase_names[] = {"load", "run", "delete"};
+#define PHASES 3
+
+struct result {
+    int height;
+    size_t ops;
+    double seconds;
+    vector<double> pct;
+    double max;
+    vector<double> counters;    // per op, NaN where unavailable
+};
+
+// names of the per-op counter columns this build and spec report
+static vector<string> counter_names(const spec &s) {
+    vector<string> names;
+    if (s.perf) {
+        for (auto n: perf_event_names) {
+            names.push_back(n);
+        }
+    }
+#ifdef TREE_STATS
+    for (auto n: {"comparisons", "rotations", "fixups", "visited"}) {
+        names.push_back(n);
+    }
+#endif
+    return names;
+}
+
+// one row: throughput, latency percentiles and counters of one phase
+static void report(const spec &s, const string &tree, const string &run,
+                   const string &phase, const result &r) {
+    cout << tree << "," << run << "," << phase << "," << s.keys << ","
+         << (s.keys == "int" ? sizeof(long) : s.klen) << ","
+         << s.n << "," << s.load << "," << s.mix << "," << s.dist << "," << s.miss << ","
+         << r.height << "," << r.ops << "," << r.seconds << "," << r.ops / r.seconds;
+    for (auto p: r.pct) {
+        cout << "," << p;
+    }
+    cout << "," << r.max;
+    for (auto c: r.counters) {
+        if (std::isnan(c))
+            cout << ",NA";
+        else
+            cout << "," << c;
+    }
+    cout << endl;
+}
+
+static enum rb_tree_type tree_type(const string &name) {
+    if (name == "rb")
+        return T_RB;
+    if (name == "avl")
+        return T_AVL;
+    if (name == "treap")
+        return T_TREAP;
+    if (name == "btree")
+        return T_BTREE;
+    return T_BST;
+}
+
+typedef std::chrono::steady_clock clock_type;
+
+// keeps the reads from being optimized away
+static volatile unsigned long sink_out;
+
+static unsigned long since(clock_type::time_point t0, clock_type::time_point t1) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+}
+
+// per-op latencies and counters over one phase
+struct meter {
+    struct hdr_hist hist;
+    struct perf_counters *pc;   // NULL unless perf=1
+    clock_type::time_point start;
+
+    void begin() {
+        hdr_init(&hist);
+#ifdef TREE_STATS
+        tree_stats = {};
+#endif
+        if (pc)
+            perf_counters_start(pc);
+        start = clock_type::now();
+    }
+
+    void end(result &r, struct tree *t) {
+        r.seconds = since(start, clock_type::now()) / 1e9;
+        if (pc)
+            perf_counters_stop(pc);
+        r.height = tree_height(t, t->root);
+        r.ops = hist.count;
+        r.pct.clear();
+        for (auto p: percentiles) {
+            r.pct.push_back(hdr_percentile(&hist, p));
+        }
+        r.max = hist.max;
+        double ops = std::max<double>(r.ops, 1);
+        r.counters.clear();
+        if (pc) {
+            for (auto v: pc->value) {
+                r.counters.push_back(v == PERF_NA ? NAN : v / ops);
+            }
+        }
+#ifdef TREE_STATS
+        r.counters.push_back(tree_stats.comparisons / ops);
+        r.counters.push_back(tree_stats.rotations / ops);
+        r.counters.push_back(tree_stats.fixups / ops);
+        r.counters.push_back(tree_stats.visited / ops);
+#endif
+    }
+};
+
+// load, run and delete phases on a fresh tree; fills res[0..2]
+static void run_tree(const spec &s, const string &name, key_set &ks,
+                     const vector<size_t> &order, const vector<op> &ops,
+                     size_t inserts, std::mt19937_64 &rng, struct perf_counters *pc,
+                     result res[PHASES]) {
+    struct tree t = T_INITIAL;
+    t.type = tree_type(name);
+    t.int_keys = ks.ints;
+    t.key_less = str_less;
+    t.key_cmp = str_cmp;
+    t.priority_less = pri_less;
+    vector<struct tree_node> nodes(s.n + inserts);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i].key = ks.key(i);
+        nodes[i].data = NULL;
+        nodes[i].fea.priority = reinterpret_cast<void*>(static_cast<long>(rng() >> 1));
+    }
+
+    std::unique_ptr<meter> m(new meter);
+    m->pc = pc;
+    vector<size_t> live;
+    live.reserve(s.n + inserts);
+    m->begin();
+    for (auto i: order) {
+        auto t0 = clock_type::now();
+        tree_insert(&t, &nodes[i]);
+        hdr_record(&m->hist, since(t0, clock_type::now()));
+        live.push_back(i);
+    }
+    m->end(res[0], &t);
+
+    size_t next_insert = s.n, misses = ks.size() - s.n - inserts;
+    unsigned long sink = 0;
+    m->begin();
+    for (auto &o: ops) {
+        size_t n = live.size(), k;
+        if (s.dist == "uniform")
+            k = o.r % n;
+        else if (s.dist == "latest")
+            k = n - 1 - o.r % n;
+        else
+            k = (o.r * 0x9e3779b97f4a7c15ULL) % n;  // scatter the hot ranks
+        int type = o.type;
+        if (type == OP_INSERT && next_insert == s.n + inserts)
+            type = OP_READ;
+        if (type == OP_DELETE && n == 1)
+            type = OP_READ;
+        void *key = o.miss ? ks.key(s.n + inserts + o.r % misses) : nodes[live[k]].key;
+        auto t0 = clock_type::now();
+        switch (type) {
+        case OP_READ:
+            sink += tree_search(&t, key) != t_nil;
+            break;
+        case OP_UPDATE:
+            tree_search(&t, key)->data = reinterpret_cast<void*>(sink++);
+            break;
+        case OP_RMW: {
+            struct tree_node *x = tree_search(&t, key);
+            if (x != t_nil)
+                x->data = reinterpret_cast<void*>(reinterpret_cast<long>(x->data) + 1);
+            break;
+        }
+        case OP_INSERT:
+            tree_insert(&t, &nodes[next_insert]);
+            break;
+        case OP_DELETE:
+            tree_delete(&t, &nodes[live[k]]);
+            break;
+        case OP_SCAN: {
+            struct tree_node *x = tree_lower_bound(&t, key);
+            for (size_t i = 0; i < o.len && x != t_nil; i++, x = tree_successor(&t, x)) {
+                sink += reinterpret_cast<long>(x->data);
+            }
+            break;
+        }
+        }
+        hdr_record(&m->hist, since(t0, clock_type::now()));
+        if (type == OP_INSERT) {
+            live.push_back(next_insert++);
+        } else if (type == OP_DELETE) {
+            live[k] = live.back();
+            live.pop_back();
+        }
+    }
+    m->end(res[1], &t);
+    sink_out = sink;
+
+    std::shuffle(live.begin(), live.end(), rng);
+    m->begin();
+    for (auto i: live) {
+        auto t0 = clock_type::now();
+        tree_delete(&t, &nodes[i]);
+        hdr_record(&m->hist, since(t0, clock_type::now()));
+    }
+    m->end(res[2], &t);
+    if (t.type == T_BTREE)
+        btree_destroy(&t);
+}
+
+int main(int argc, char *argv[]) {
+    spec s;
+    if (argc == 2 && string(argv[1]) == "help") {
+        usage();
+        return 0;
+    }
+    if (!parse(s, argc, argv)) {
+        usage();
+        return 1;
+    }
+    std::mt19937_64 rng(s.seed);
+    // room for every insert the mix can ask for, and a pool of misses
+    size_t inserts = static_cast<size_t>(s.frac[OP_INSERT] / frac_sum(s) * s.ops * 1.1) + 16;
+    size_t misses = s.miss > 0 ? std::max<size_t>(s.n / 4, 16) : 0;
+    key_set ks = make_keys(s, s.n + inserts + misses, rng);
+    vector<size_t> order = load_order(s, ks, rng);
+    vector<op> ops = make_ops(s, misses, rng);
+
+    cout << "tree,run,phase,keys,klen,n,load,mix,dist,miss,height,ops,seconds,ops_per_s";
+    for (auto p: percentiles) {
+        cout << ",p" << p << "_ns";
+    }
+    cout << ",max_ns";
+    vector<string> counters = counter_names(s);
+    for (auto &c: counters) {
+        cout << "," << c;
+    }
+    cout << endl;
+
+    struct perf_counters pc, *pcp = NULL;
+    if (s.perf) {
+        if (perf_counters_open(&pc) < 0)
+            perror("perf_event_open");
+        pcp = &pc;
+    }
+
+    std::istringstream names(s.trees);
+    string name;
+    while (std::getline(names, name, ',')) {
+        vector<result> runs[PHASES];
+        for (int r = 0; r < s.runs; r++) {
+            result res[PHASES];
+            run_tree(s, name, ks, order, ops, inserts, rng, pcp, res);
+            for (int ph = 0; ph < PHASES; ph++) {
+                report(s, name, std::to_string(r), phase_names[ph], res[ph]);
+                runs[ph].push_back(res[ph]);
+            }
+        }
+        if (s.runs == 1)
+            continue;
+        // mean over the runs
+        for (int ph = 0; ph < PHASES; ph++) {
+            result mean = {0, runs[ph][0].ops, 0, vector<double>(runs[ph][0].pct.size()), 0,
+                           vector<double>(runs[ph][0].counters.size())};
+            double height = 0;
+            for (auto &r: runs[ph]) {
+                height += r.height;
+                mean.seconds += r.seconds / s.runs;
+                for (size_t i = 0; i < r.pct.size(); i++) {
+                    mean.pct[i] += r.pct[i] / s.runs;
+                }
+                mean.max += r.max / s.runs;
+                for (size_t i = 0; i < r.counters.size(); i++) {
+                    mean.counters[i] += r.counters[i] / s.runs;
+                }
+            }
+            mean.height = static_cast<int>(height / s.runs);
+            report(s, name, "mean", phase_names[ph], mean);
+        }
+    }
+    if (pcp)
+        perf_counters_close(pcp);
+    return 0;
+}